@@ -0,0 +1,21 @@
+#ifndef ALLOCATOR_H_
+# define ALLOCATOR_H_
+
+# include "opening_hours.h"
+
+/*
+ * Allocation functions of the library, going through the allocator set
+ * by the application (see src/allocator.c). alloc_or_die() returns the
+ * result of an allocation, or exits naming what it was for if it failed;
+ * calloc_or_die() allocates zeroed memory with an allocator, the current
+ * one given NULL, the same way.
+ */
+
+void *_oh_malloc(size_t);
+void *_oh_calloc(size_t, size_t);
+void *_oh_realloc(void *, size_t);
+void _oh_free(void *);
+void *alloc_or_die(void *, const char *);
+void *calloc_or_die(const oh_allocator *, size_t, size_t, const char *);
+
+#endif /* !ALLOCATOR_H_ */
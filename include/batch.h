@@ -0,0 +1,12 @@
+#ifndef BATCH_H_
+# define BATCH_H_
+
+/*
+ * Batch mode of the standalone binary (see src/batch.c): checks every
+ * line of a file, or of stdin, and writes one result per line.
+ * Takes the arguments following --batch; returns the exit status.
+ */
+
+int run_batch(int ac, char **av);
+
+#endif /* !BATCH_H_ */
@@ -2,6 +2,7 @@
 # define BITSET_H_
 
 # include <stdlib.h>
+# include <string.h>
 
 # ifdef _DEBUG
 /* Include stdio, needed to define printf calls in printf_bitset(). */
@@ -52,6 +53,31 @@
  * bitwise_or(bitset s1, bitset s2);
  *   Returns a new bitset created from the or binary operation between s1 and s2.
  *
+ * bitwise_xor(bitset s1, bitset s2);
+ *   Returns a new bitset created from the xor binary operation between s1 and s2.
+ *
+ * bitwise_andnot(bitset s1, bitset s2);
+ *   Returns a new bitset holding the bits of s1 which aren't set in s2.
+ *
+ * bitwise_nand(bitset s1, bitset s2), bitwise_nor(bitset s1, bitset s2), bitwise_xnor(bitset s1, bitset s2);
+ *   Returns a new bitset created from the nand (resp. nor, xnor) binary operation between s1 and s2.
+ *   Bits past the smallest operand's size are taken as false in it.
+ *
+ * bitwise_not_to(bitset dest, bitset set), bitwise_and_to(bitset dest, bitset s1, bitset s2), ...:
+ *   Same as above, without allocating anything: the result is written into dest, and returned.
+ *   dest must be at least as large as the operands, and may be one of them.
+ *
+ * bitset_count(bitset set):
+ *   Returns the number of bits set.
+ *
+ * bitset_next_set(bitset set, size_t from), bitset_next_clear(bitset set, size_t from):
+ *   Returns the position of the first bit set (resp. clear) at or after from, or BITSET_SIZE(set) if there is none.
+ *   Whole words are skipped at once, so the cost depends on the distance to that bit divided by the word size.
+ *
+ * bitset_runs(set, from, to, start, end) { ... }:
+ *   Loops over the runs of bits set among the [from, to) positions: for each run, start is its first position and
+ *   end the position after its last one (at most to). Only reads the words, so set may also be a plain word array.
+ *
  * SET_BIT(bitset set, size_t index, bool state):
  *   Set the bit at position index to the state given as parameter.
  *
@@ -63,18 +89,6 @@
  *   Returns the number of bits of the bitset.
  *
  * TODO:
- *   bitwise_xor(bitset s1, bitset s2);
- *     Returns a new bitset created from the xor binary operation between s1 and s2.
- *
- *   bitwise_nand(bitset s1, bitset s2);
- *     Returns a new bitset created from the nand binary operation between s1 and s2.
- *
- *   bitwise_nor(bitset s1, bitset s2);
- *     Returns a new bitset created from the nor binary operation between s1 and s2.
- *
- *   bitwise_xnor(bitset s1, bitset s2);
- *     Returns a new bitset created from the xnor binary operation between s1 and s2.
- *
  *   convert_from(void *from, size_t nbits);
  *     Returns a newly created bitset from the nbits bits from the from pointer.
  *
@@ -94,10 +108,29 @@ enum bool {
 	true = 1
 };
 
+/*
+ * Out-of-line parts of the macros below (see src/bitset.c): bitsets are
+ * allocated by the allocator of the library, and word arrays go through
+ * the fastest kernels the CPU supports.
+ */
+void *_bitset_calloc(size_t, size_t);
+void *_bitset_realloc(void *, size_t);
+void _bitset_free(void *);
+void _bitset_and_words(_word_t *, const _word_t *, const _word_t *, size_t);
+void _bitset_or_words(_word_t *, const _word_t *, const _word_t *, size_t);
+void _bitset_xor_words(_word_t *, const _word_t *, const _word_t *, size_t);
+void _bitset_andnot_words(_word_t *, const _word_t *, const _word_t *, size_t);
+void _bitset_not_words(_word_t *, const _word_t *, size_t);
+bool _bitset_equal_words(const _word_t *, const _word_t *, size_t);
+size_t _bitset_popcount_words(const _word_t *, size_t);
+void _bitset_fill_words(_word_t *, _word_t, size_t);
+
 # define _WORD_NBYTES               (sizeof(_word_t))
 # define _WORD_SIZE                 (_WORD_NBYTES * 8)
 # define _B_INDEX(index)            ((index) / _WORD_SIZE)
 # define _B_OFFSET(index)           ((index) % _WORD_SIZE)
+# define _B_NWORDS(nbits)           (_B_INDEX(nbits) + !!_B_OFFSET(nbits))
+# define _LAST_WORD_MASK(nbits)     (_B_OFFSET(nbits) ? ~(~ (_word_t) 0 << _B_OFFSET(nbits)) : ~ (_word_t) 0)
 
 # define _MIN(A, B)                 (((A) < (B)) ? A : B)
 # define _MAX(A, B)                 (((A) > (B)) ? A : B)
@@ -115,27 +148,33 @@ enum bool {
 
 # define BITSET_SIZE(set)           ((size_t) *(set - 1))
 
+# define BITSET_NBYTES(set)         ((_B_INDEX(BITSET_SIZE(set)) + !!_B_OFFSET(BITSET_SIZE(set)) + 1) * sizeof(_word_t))
+
+/* Hook called with the number of bytes of each bitset allocation, overridable before any Bitset() call. */
+# ifndef _BITSET_ALLOC_HOOK
+#  define _BITSET_ALLOC_HOOK(nbytes) ((void) 0)
+# endif /* !_BITSET_ALLOC_HOOK */
+
 # define Bitset(nbits) ({                                                                                                       \
-	bitset _set = ((bitset) calloc(_B_INDEX(nbits) + !!_B_OFFSET(nbits) + 1, sizeof(_word_t))) + 1;                         \
+	bitset _set = ((bitset) _bitset_calloc(_B_INDEX(nbits) + !!_B_OFFSET(nbits) + 1, sizeof(_word_t))) + 1;                 \
+	_BITSET_ALLOC_HOOK((_B_INDEX(nbits) + !!_B_OFFSET(nbits) + 1) * sizeof(_word_t));                                       \
 	*(_set - 1) = nbits;                                                                                                    \
 	_set;                                                                                                                   \
 })
 
 # define resize_bitset(set, size) ({                                                                                            \
-	set = (bitset) realloc(set - 1, size + sizeof(_word_t)) + 1;                                                            \
+	set = (bitset) _bitset_realloc(set - 1, size + sizeof(_word_t)) + 1;                                                    \
 	set_subset(set, BITSET_SIZE(set), size, 0);                                                                             \
 	*(set - 1) = size;                                                                                                      \
 })
 
-# define del_bitset(set) ({ free(set - 1); })
+# define del_bitset(set) ({ _bitset_free(set - 1); })
 
 # define copy_bitset(original) ({                                                                                               \
-	size_t _i = BITSET_SIZE(original);                                                                                      \
-	bitset _copy = Bitset(_i);                                                                                              \
+	bitset _original = original,                                                                                            \
+	       _copy = Bitset(BITSET_SIZE(_original));                                                                          \
                                                                                                                                 \
-	_i = _B_INDEX(_i) + !!_B_OFFSET(_i);                                                                                    \
-	while (_i--)                                                                                                            \
-		_copy[_i] = original[_i];                                                                                       \
+	memcpy(_copy, _original, _B_NWORDS(BITSET_SIZE(_original)) * sizeof(_word_t));                                          \
 	_copy;                                                                                                                  \
 })
 
@@ -147,24 +186,23 @@ enum bool {
 	if (_from < _to) {                                                                                                      \
 		if (_B_INDEX(_from) == _B_INDEX(_to)) {                                                                         \
 			if (_state)                                                                                             \
-				set[_B_INDEX(_from)] |=                                                                         \
+				(set)[_B_INDEX(_from)] |=                                                                       \
  					  ~(~ (_word_t) 0 << (_B_OFFSET(_to) - _B_OFFSET(_from))) << _B_OFFSET(_from);          \
 			else                                                                                                    \
-				set[_B_INDEX(_from)] &=                                                                         \
+				(set)[_B_INDEX(_from)] &=                                                                       \
 					~(~(~ (_word_t) 0 << (_B_OFFSET(_to) - _B_OFFSET(_from))) << _B_OFFSET(_from));         \
 		} else {                                                                                                        \
 			u_int i = _B_INDEX(_from);                                                                              \
 			if (_state) {                                                                                           \
-				set[_B_INDEX(_from)] |=    (~ (_word_t) 0 << _B_OFFSET(_from));                                 \
+				(set)[_B_INDEX(_from)] |=    (~ (_word_t) 0 << _B_OFFSET(_from));                               \
 				if (_B_OFFSET(_to))                                                                             \
-					set[_B_INDEX(_to)]   |=   ~(~ (_word_t) 0 << _B_OFFSET(_to));                           \
-				while (++i < _B_INDEX(_to))                                                                     \
-					_SET_INDEX(set, i);                                                                     \
+					(set)[_B_INDEX(_to)]   |=   ~(~ (_word_t) 0 << _B_OFFSET(_to));                         \
+				_bitset_fill_words((set) + i + 1, ~ (_word_t) 0, _B_INDEX(_to) - i - 1);                        \
 			} else {                                                                                                \
-				set[_B_INDEX(_from)] &=   ~(~ (_word_t) 0 << _B_OFFSET(_from));                                 \
-				set[_B_INDEX(_to)]   &=    (~ (_word_t) 0 << _B_OFFSET(_to));                                   \
-				while (++i < _B_INDEX(_to))                                                                     \
-					_RESET_INDEX(set, i);                                                                   \
+				(set)[_B_INDEX(_from)] &=   ~(~ (_word_t) 0 << _B_OFFSET(_from));                               \
+				if (_B_OFFSET(_to))                                                                             \
+					(set)[_B_INDEX(_to)]   &=    (~ (_word_t) 0 << _B_OFFSET(_to));                         \
+				_bitset_fill_words((set) + i + 1, 0, _B_INDEX(_to) - i - 1);                                    \
 			}                                                                                                       \
 		}                                                                                                               \
 	}                                                                                                                       \
@@ -200,75 +238,139 @@ enum bool {
 })
 
 # define compare_bitsets(s1, s2) ({                                                                                             \
-	size_t _min_len = _MIN(_B_INDEX(BITSET_SIZE(s1)), _B_INDEX(BITSET_SIZE(s2))),                                           \
-	       _max_len = _MAX(_B_INDEX(BITSET_SIZE(s1)), _B_INDEX(BITSET_SIZE(s2))),                                           \
-	       _i = -1;                                                                                                         \
 	bitset _s1 = s1,                                                                                                        \
 	       _s2 = s2;                                                                                                        \
-	bool valid = true;                                                                                                      \
+	size_t _n1, _n2, _i;                                                                                                    \
+	bool _valid;                                                                                                            \
                                                                                                                                 \
-	if (_min_len != _B_INDEX(BITSET_SIZE(_s1)))                                                                             \
+	if (BITSET_SIZE(_s1) > BITSET_SIZE(_s2))                                                                                \
 		_SWAP(_s1, _s2);                                                                                                \
-	while (valid && ++_i < _min_len)                                                                                        \
-		if (_s1[_i] != _s2[_i])                                                                                         \
-			valid = false;                                                                                          \
-	if (valid && (_s1[_i] & ~(~ (_word_t) 0 << (_WORD_SIZE - _B_OFFSET(BITSET_SIZE(_s1)))))                                 \
-			!= (_s2[_i] & (~ (_word_t) 0 >> (_WORD_SIZE - _B_OFFSET(BITSET_SIZE(_s1)))))                            \
-			|| (_min_len == _max_len                                                                                \
-				&& (_s2[_i] & (~ (_word_t) 0 >> (_WORD_SIZE - _B_OFFSET(BITSET_SIZE(_s2))                       \
-							+ _B_OFFSET(BITSET_SIZE(_s1))) << _B_OFFSET(BITSET_SIZE(_s1)))))        \
-			|| (_min_len != _max_len                                                                                \
-				&& (_s2[_i] & (~ (_word_t) 0 << (_WORD_SIZE - _B_OFFSET(BITSET_SIZE(_s1)))))))                  \
-		valid = false;                                                                                                  \
-	while (valid && ++_i < _max_len)                                                                                        \
-		if (_s2[_i])                                                                                                    \
-			valid = false;                                                                                          \
-	valid;                                                                                                                  \
+	_n1 = BITSET_SIZE(_s1), _n2 = BITSET_SIZE(_s2), _i = _B_INDEX(_n1);                                                     \
+	_valid = _bitset_equal_words(_s1, _s2, _i);                                                                             \
+	if (_valid && _B_OFFSET(_n1)) {                                                                                         \
+		_valid = !((_s1[_i] ^ _s2[_i]) & _LAST_WORD_MASK(_n1))                                                          \
+			&& !(_s2[_i] & ~_LAST_WORD_MASK(_n1) & (_i + 1 < _B_NWORDS(_n2) ? ~ (_word_t) 0 : _LAST_WORD_MASK(_n2))); \
+		++_i;                                                                                                           \
+	}                                                                                                                       \
+	for (; _valid && _i < _B_NWORDS(_n2); _i++)                                                                             \
+		_valid = !(_s2[_i] & (_i + 1 < _B_NWORDS(_n2) ? ~ (_word_t) 0 : _LAST_WORD_MASK(_n2)));                         \
+	_valid;                                                                                                                 \
 })
 
-# define bitwise_not(set) ({                                                                                                    \
-	bitset _set_not = copy_bitset(set);                                                                                     \
-	size_t _len = _B_INDEX(BITSET_SIZE(set)),                                                                               \
-	       _i = -1;                                                                                                         \
+# define bitset_count(set) ({                                                                                                   \
+	bitset _cset = set;                                                                                                     \
+	size_t _n = BITSET_SIZE(_cset);                                                                                         \
+	_word_t _last = _B_OFFSET(_n) ? _cset[_B_INDEX(_n)] & _LAST_WORD_MASK(_n) : 0;                                          \
                                                                                                                                 \
-	while (++_i < _len)                                                                                                     \
-		_set_not[_i] = ~_set_not[_i];                                                                                   \
-	_set_not[i] = ~(_set_not[_i] & (~ (_word_t) 0 >> (_WORD_SIZE - _B_OFFSET(BITSET_SIZE(_set_not)))));                     \
-	_set_not;                                                                                                               \
+	_bitset_popcount_words(_cset, _B_INDEX(_n)) + _bitset_popcount_words(&_last, 1);                                        \
 })
 
-# define bitwise_and(s1, s2) ({                                                                                                 \
-	size_t _min_len = _MIN(_B_INDEX(BITSET_SIZE(s1)), _B_INDEX(BITSET_SIZE(s2))),                                           \
-	       _i = -1;                                                                                                         \
-	bitset _s1 = s1,                                                                                                        \
-	       _s2 = s2,                                                                                                        \
-	       _set_and = Bitset(_MAX(_B_INDEX(BITSET_SIZE(s1)), _B_INDEX(BITSET_SIZE(s2))));                                   \
+/* Index of the lowest bit set in a word, which must not be 0. */
+# define _WORD_CTZ(word) ((unsigned long long) (word)                                                                           \
+	? (size_t) __builtin_ctzll((unsigned long long) (word))                                                                 \
+	: 64 + (size_t) __builtin_ctzll((unsigned long long) ((word) >> 64)))
+
+/* First position at or after from, below nbits, of a bit set in words ^ flip, or nbits. */
+# define _bitset_scan(words, from, nbits, flip) ({                                                                              \
+	const _word_t *_scan = words;                                                                                           \
+	size_t _nbits = nbits,                                                                                                  \
+	       _at = from,                                                                                                      \
+	       _w = _B_INDEX(_at);                                                                                              \
+	_word_t _word;                                                                                                          \
                                                                                                                                 \
-	if (_min_len != _B_INDEX(BITSET_SIZE(_s1)))                                                                             \
-		_SWAP(_s1, _s2);                                                                                                \
-	while (++_i <= _min_len)                                                                                                \
-		_set_and[_i] = _s1[_i] & _s2[_i];                                                                               \
-	_set_and;                                                                                                               \
+	if (_at < _nbits) {                                                                                                     \
+		_word = (_scan[_w] ^ (flip)) & (~ (_word_t) 0 << _B_OFFSET(_at));                                               \
+		while (!_word && ++_w < _B_NWORDS(_nbits))                                                                      \
+			_word = _scan[_w] ^ (flip);                                                                             \
+		_at = _word ? _MIN(_w * _WORD_SIZE + _WORD_CTZ(_word), _nbits) : _nbits;                                        \
+	}                                                                                                                       \
+	_at;                                                                                                                    \
 })
 
-# define bitwise_or(s1, s2) ({                                                                                                  \
-	size_t _min_len = _MIN(_B_INDEX(BITSET_SIZE(s1)), _B_INDEX(BITSET_SIZE(s2))),                                           \
-	       _max_len = _MAX(_B_INDEX(BITSET_SIZE(s1)), _B_INDEX(BITSET_SIZE(s2))),                                           \
-	       _i = -1;                                                                                                         \
-	bitset _s1 = s1,                                                                                                        \
-	       _s2 = s2,                                                                                                        \
-	       _set_or,                                                                                                         \
+# define bitset_next_set(set, from)      _bitset_scan(set, from, BITSET_SIZE(set), 0)
+# define bitset_next_clear(set, from)    _bitset_scan(set, from, BITSET_SIZE(set), ~ (_word_t) 0)
+
+# define bitset_runs(set, from, to, start, end)                                                                                 \
+	for ((start) = _bitset_scan(set, from, to, 0);                                                                          \
+			(start) < (to) && ((end) = _bitset_scan(set, start, to, ~ (_word_t) 0), true);                          \
+			(start) = _bitset_scan(set, end, to, 0))
+
+# define bitwise_not_to(dest, set) ({                                                                                           \
+	bitset _dest = dest,                                                                                                    \
+	       _src = set;                                                                                                      \
+	size_t _len = _B_NWORDS(BITSET_SIZE(_src));                                                                             \
                                                                                                                                 \
-	if (_min_len != _B_INDEX(BITSET_SIZE(_s1)))                                                                             \
-		_SWAP(_s1, _s2);                                                                                                \
-	_set_or = copy_bitset(_s2);                                                                                             \
+	_bitset_not_words(_dest, _src, _len);                                                                                   \
+	if (_len)                                                                                                               \
+		_dest[_len - 1] &= _LAST_WORD_MASK(BITSET_SIZE(_src));                                                          \
+	_dest;                                                                                                                  \
+})
+
+/* Common words go through the kernel; words only one operand has see zeros in the other. */
+# define _bitwise_to(dest, s1, s2, kernel, OP) ({                                                                               \
+	bitset _dest = dest,                                                                                                    \
+	       _s1 = s1,                                                                                                        \
+	       _s2 = s2;                                                                                                        \
+	size_t _len1 = _B_NWORDS(BITSET_SIZE(_s1)),                                                                             \
+	       _len2 = _B_NWORDS(BITSET_SIZE(_s2)),                                                                             \
+	       _len = _B_NWORDS(BITSET_SIZE(_dest)),                                                                            \
+	       _i = _MIN(_len, _MIN(_len1, _len2));                                                                             \
                                                                                                                                 \
-	while (++_i < _min_len)                                                                                                 \
-		_set_or[_i] |= _s1[_i];                                                                                         \
-	_set_or[_i] |= _s1[_i] & (~ (_word_t) 0 >> (_WORD_SIZE - _B_OFFSET(BITSET_SIZE(_s1))))                                  \
-	_set_or;                                                                                                                \
+	_bitset_##kernel(_dest, _s1, _s2, _i);                                                                                  \
+	for (; _i < _len; _i++)                                                                                                 \
+		_dest[_i] = (_i < _len1 ? _s1[_i] : 0) OP (_i < _len2 ? _s2[_i] : 0);                                           \
+	_dest;                                                                                                                  \
 })
 
+# define bitwise_and_to(dest, s1, s2)    _bitwise_to(dest, s1, s2, and_words, &)
+# define bitwise_or_to(dest, s1, s2)     _bitwise_to(dest, s1, s2, or_words, |)
+# define bitwise_xor_to(dest, s1, s2)    _bitwise_to(dest, s1, s2, xor_words, ^)
+# define bitwise_andnot_to(dest, s1, s2) _bitwise_to(dest, s1, s2, andnot_words, & ~)
+
+# define bitwise_nand_to(dest, s1, s2) ({                                                                                       \
+	bitset _ndest = dest;                                                                                                   \
+                                                                                                                                \
+	bitwise_and_to(_ndest, s1, s2);                                                                                         \
+	bitwise_not_to(_ndest, _ndest);                                                                                         \
+})
+
+# define bitwise_nor_to(dest, s1, s2) ({                                                                                        \
+	bitset _ndest = dest;                                                                                                   \
+                                                                                                                                \
+	bitwise_or_to(_ndest, s1, s2);                                                                                          \
+	bitwise_not_to(_ndest, _ndest);                                                                                         \
+})
+
+# define bitwise_xnor_to(dest, s1, s2) ({                                                                                       \
+	bitset _ndest = dest;                                                                                                   \
+                                                                                                                                \
+	bitwise_xor_to(_ndest, s1, s2);                                                                                         \
+	bitwise_not_to(_ndest, _ndest);                                                                                         \
+})
+
+# define bitwise_not(set) ({                                                                                                    \
+	bitset _set_not = set;                                                                                                  \
+                                                                                                                                \
+	bitwise_not_to(Bitset(BITSET_SIZE(_set_not)), _set_not);                                                                \
+})
+
+/* Allocates a bitset as large as the largest operand, for the op##_to form to fill. */
+# define _bitwise_alloc(s1, s2, op) ({                                                                                          \
+	bitset _op1 = s1,                                                                                                       \
+	       _op2 = s2;                                                                                                       \
+	size_t _size = _MAX(BITSET_SIZE(_op1), BITSET_SIZE(_op2));                                                              \
+                                                                                                                                \
+	op##_to(Bitset(_size), _op1, _op2);                                                                                     \
+})
+
+# define bitwise_and(s1, s2)             _bitwise_alloc(s1, s2, bitwise_and)
+# define bitwise_or(s1, s2)              _bitwise_alloc(s1, s2, bitwise_or)
+# define bitwise_xor(s1, s2)             _bitwise_alloc(s1, s2, bitwise_xor)
+# define bitwise_andnot(s1, s2)          _bitwise_alloc(s1, s2, bitwise_andnot)
+# define bitwise_nand(s1, s2)            _bitwise_alloc(s1, s2, bitwise_nand)
+# define bitwise_nor(s1, s2)             _bitwise_alloc(s1, s2, bitwise_nor)
+# define bitwise_xnor(s1, s2)            _bitwise_alloc(s1, s2, bitwise_xnor)
+
 # ifdef _DEBUG
 
 #  define print_bitset(set) ({                                                                                                  \
@@ -0,0 +1,32 @@
+#ifndef BITSET_KERNELS_H_
+# define BITSET_KERNELS_H_
+
+# include "bitset.h"
+
+/*
+ * Word-array kernels behind the bitset.h operations (see src/bitset.c).
+ * The best version the CPU supports is selected at load time;
+ * bitset_select_kernels() forces one by name ("scalar", "sse2", "avx2",
+ * "avx512"), or the best one again given NULL, and returns 0 if it isn't
+ * supported.
+ */
+
+typedef struct _bitset_kernels _bitset_kernels;
+
+struct _bitset_kernels {
+	const char *name;
+	void (*and_words)(_word_t *, const _word_t *, const _word_t *, size_t);
+	void (*or_words)(_word_t *, const _word_t *, const _word_t *, size_t);
+	void (*xor_words)(_word_t *, const _word_t *, const _word_t *, size_t);
+	void (*andnot_words)(_word_t *, const _word_t *, const _word_t *, size_t);
+	void (*not_words)(_word_t *, const _word_t *, size_t);
+	bool (*equal_words)(const _word_t *, const _word_t *, size_t);
+	size_t (*popcount_words)(const _word_t *, size_t);
+	void (*fill_words)(_word_t *, _word_t, size_t);
+};
+
+extern const _bitset_kernels *_bitset_ops;
+
+int bitset_select_kernels(const char *);
+
+#endif /* !BITSET_KERNELS_H_ */
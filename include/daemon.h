@@ -0,0 +1,16 @@
+#ifndef DAEMON_H_
+# define DAEMON_H_
+
+/*
+ * Server mode of the standalone binary (see src/daemon.c).
+ *
+ * serve_stream() answers requests read from in until its end, writing the
+ * responses to out. serve_socket() listens on a Unix domain socket, and
+ * never returns unless it cannot be set up.
+ * Both return 0 on success, -1 on error.
+ */
+
+int serve_stream(int in, int out);
+int serve_socket(const char *path);
+
+#endif /* !DAEMON_H_ */
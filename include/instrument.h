@@ -0,0 +1,77 @@
+#ifndef INSTRUMENT_H_
+# define INSTRUMENT_H_
+
+# include "opening_hours.h"
+
+/*
+ * Hot-path counters.
+ *
+ * Everything here expands to nothing unless OH_INSTRUMENT is defined, so
+ * that the default build doesn't pay a single instruction for it:
+ *   - OH_COUNT(field, n) adds n to the current thread's counter field.
+ *   - OH_CALL_BEGIN() marks the beginning of an is_open() call.
+ *   - OH_PARSE_BEGIN() marks the beginning of a build_opening_hours() call.
+ *   - OH_TIMER_START(var) / OH_TIMER_STOP(var, field) accumulate the
+ *     time spent between both calls into field.
+ *
+ */
+
+# ifdef OH_INSTRUMENT
+
+typedef struct oh_thread_counters oh_thread_counters;
+
+struct oh_thread_counters {
+	oh_counters counters;
+	unsigned long current_rules_scanned;
+	bool registered;
+	oh_thread_counters *next;
+};
+
+extern __thread oh_thread_counters oh_thread_counters_;
+
+void oh_instrument_register(void);
+unsigned long oh_instrument_clock(void);
+
+#  define OH_COUNT(field, n)        (oh_thread_counters_.counters.field += (n))
+
+#  define OH_CALL_BEGIN() ({ \
+		if (!oh_thread_counters_.registered) \
+			oh_instrument_register(); \
+		if (oh_thread_counters_.current_rules_scanned > oh_thread_counters_.counters.max_rules_scanned) \
+			oh_thread_counters_.counters.max_rules_scanned = oh_thread_counters_.current_rules_scanned; \
+		oh_thread_counters_.current_rules_scanned = 0; \
+		OH_COUNT(is_open_calls, 1); \
+	})
+
+#  define OH_PARSE_BEGIN() ({ \
+		if (!oh_thread_counters_.registered) \
+			oh_instrument_register(); \
+		OH_COUNT(parses, 1); \
+	})
+
+#  define OH_RULE_SCANNED() ({ \
+		++oh_thread_counters_.current_rules_scanned; \
+		OH_COUNT(rules_scanned, 1); \
+	})
+
+#  define OH_TIMER_START(var)       unsigned long var = oh_instrument_clock()
+#  define OH_TIMER_STOP(var, field) OH_COUNT(field, oh_instrument_clock() - var)
+
+#  undef _BITSET_ALLOC_HOOK
+#  define _BITSET_ALLOC_HOOK(nbytes) ({ \
+		OH_COUNT(bitset_allocations, 1); \
+		OH_COUNT(bitset_bytes, nbytes); \
+	})
+
+# else
+
+#  define OH_COUNT(field, n)        ((void) 0)
+#  define OH_CALL_BEGIN()           ((void) 0)
+#  define OH_PARSE_BEGIN()          ((void) 0)
+#  define OH_RULE_SCANNED()         ((void) 0)
+#  define OH_TIMER_START(var)       ((void) 0)
+#  define OH_TIMER_STOP(var, field) ((void) 0)
+
+# endif /* !OH_INSTRUMENT */
+
+#endif /* !INSTRUMENT_H_ */
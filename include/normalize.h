@@ -0,0 +1,67 @@
+#ifndef NORMALIZE_H_
+# define NORMALIZE_H_
+
+# include "opening_hours.h"
+# include "allocator.h"
+# include "bitset_kernels.h"
+
+/*
+ * Normalized form of an opening_hours object.
+ *
+ * Whatever the rules which gave it, the behaviour of an object is a
+ * function from (year, monthday) to the week it describes: 7 days of
+ * 24 * 60 minutes, each bit being set where the object is open.
+ *
+ * Years (and monthdays) behaving the same are gathered into classes, so
+ * the function is stored as a small table of week profiles, one for each
+ * (year class, monthday class) pair. Classes are merged until no two of
+ * them behave the same, and sorted by their first member: two objects
+ * behaving the same always have the same normalized form, bit for bit.
+ *
+ * Monthday classes only hold monthdays existing in a leap year (no Feb 30,
+ * no Apr 31...), which never belong to any class.
+ *
+ */
+
+# define NB_YEARS         1024
+# define NB_MONTHDAYS     (12 * 32)
+# define DAY_MINUTES      (24 * 60)
+# define DAY_NWORDS       _B_NWORDS(DAY_MINUTES)
+# define WEEK_NWORDS      (7 * DAY_NWORDS)
+
+# define NO_CLASS         ((unsigned short) -1)
+
+typedef struct normalized_oh normalized_oh;
+typedef enum normalized_op normalized_op;
+
+enum normalized_op {
+	NORMALIZED_AND = 0,
+	NORMALIZED_OR,
+	NORMALIZED_ANDNOT,
+	NORMALIZED_XOR
+};
+
+struct normalized_oh {
+	size_t nb_years;
+	size_t nb_monthdays;
+	bitset *years;                            /* nb_years bitsets, NB_YEARS bits each         */
+	bitset *monthdays;                        /* nb_monthdays bitsets, NB_MONTHDAYS bits each */
+	unsigned short year_class[NB_YEARS];
+	unsigned short monthday_class[NB_MONTHDAYS];
+	_word_t *weeks;                           /* nb_years * nb_monthdays profiles             */
+};
+
+/* Week profile of a (year class, monthday class) pair, each day being DAY_NWORDS words long: */
+# define NORMALIZED_WEEK(n, year, monthday) \
+	((n)->weeks + ((year) * (n)->nb_monthdays + (monthday)) * WEEK_NWORDS)
+
+normalized_oh *normalize_oh(opening_hours);
+normalized_oh *combine_normalized(normalized_oh *, normalized_oh *, normalized_op);
+opening_hours normalized_to_oh(normalized_oh *);
+void free_normalized(normalized_oh *);
+bool valid_monthday(size_t);
+void day_profile(opening_hours, int, int, int, _word_t *);
+void rule_week(rule_sequence *, _word_t *);
+int next_selection_change(opening_hours, int, int);
+
+#endif /* !NORMALIZE_H_ */
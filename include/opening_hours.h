@@ -11,6 +11,10 @@
 # define WEEKDAY_STR      ((char [][3]){"Mo", "Tu", "We", "Th", "Fr", "Sa", "Su"})
 # define MONTHS_STR      ((char [][4]){"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"})
 # define NB_DAYS         ((int []){31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31})
+
+/* Position in weekday bitsets (Mo = 0) of a struct tm day of the week (Su = 0): */
+# define WEEKDAY_INDEX(tm_wday) (((tm_wday) + 6) % 7)
+# define SOLAR_EVENTS_STR ((char [][8]){"dawn", "sunrise", "sunset", "dusk"})
 # define MONTHS_FULLSTR  ((char [][10]){\
 		"january", \
 		"february", \
@@ -28,6 +32,18 @@
 
 
 # define COMMENT_SIZE 128
+# define OH_ERROR_SIZE 256
+
+/* Element types, in the high bits of the ids oh_store_load_osm() stores schedules under: */
+# define OH_OSM_WAY       (1ULL << 62)
+# define OH_OSM_RELATION  (2ULL << 62)
+
+/* UTC timestamps of the first and last seconds of the years selectors can hold (1900 to 2923): */
+# define OH_MIN_TIME      (-2208988800LL)
+# define OH_MAX_TIME      30105302399LL
+
+/* Length of the histograms oh_open_histogram() fills: */
+# define OH_WEEK_MINUTES  (7 * 24 * 60)
 
 /*
  * Typedefs:
@@ -44,11 +60,28 @@ typedef struct wide_range_selector wide_range_selector;
 typedef struct year_range year_range;
 typedef struct year_selector year_selector;
 typedef struct rule_modifier rule_modifier;
+typedef struct oh_memory_stats oh_memory_stats;
+typedef struct oh_counters oh_counters;
+typedef struct oh_fingerprint oh_fingerprint;
+typedef struct oh_store oh_store;
+typedef struct oh_error oh_error;
+typedef struct oh_interval oh_interval;
+typedef struct oh_diff oh_diff;
+typedef struct oh_allocator oh_allocator;
+typedef struct adaptive_order adaptive_order;
+typedef struct time_point time_point;
+typedef struct variable_span variable_span;
+typedef struct solar_table solar_table;
+typedef struct solar_location solar_location;
+
+struct when;
+typedef int (*oh_evaluator)(opening_hours, struct when);
 
 typedef enum rule_separator rule_separator;
 typedef enum rule_modifier_type rule_modifier_type;
 typedef enum wide_range_selector_type wide_range_selector_type;
 typedef enum weekday_selector_type weekday_selector_type;
+typedef enum solar_event solar_event;
 
 /*
  * Types declarations:
@@ -66,6 +99,15 @@ enum weekday_selector_type {
 	WD_NTH_OF_MONTH
 };
 
+/* Events variable times refer to, in the order of SOLAR_EVENTS_STR: */
+enum solar_event {
+	SOLAR_NONE = 0,
+	SOLAR_DAWN,
+	SOLAR_SUNRISE,
+	SOLAR_SUNSET,
+	SOLAR_DUSK
+};
+
 enum rule_separator {
 	SEP_NOT_SET = 0,
 	SEP_HEAD,
@@ -113,9 +155,22 @@ struct weekday_selector {
 	};
 };
 
+struct time_point {
+	solar_event event;
+	int minutes;            /* since midnight, or offset from the event */
+};
+
+/* Span of hours with a variable end, such as "sunrise-sunset" (see src/solar.c). */
+struct variable_span {
+	time_point from;
+	time_point to;
+};
+
 struct time_selector {
 	bitset time_range;
 	bitset extended_time_range;
+	variable_span *variable;
+	size_t nb_variable;
 };
 
 struct small_range_selector {
@@ -140,11 +195,115 @@ struct rule_sequence {
 	rule_modifier state;
 };
 
+/* Where a schedule is, for its variable times (see oh_set_location()). */
+struct solar_location {
+	solar_table *table;     /* NULL: default times */
+	int shift;              /* minutes added to the times of the table */
+};
+
 struct opening_hours {
 	opening_hours next_item;
 	bool aligned;
 	rule_sequence rule;
+	size_t begin;           /* Byte range of the rule in the parsed string */
+	size_t end;
 	char *to_str;
+	oh_evaluator evaluate;  /* is_open() for the shape of the rules, set on the first one */
+	adaptive_order *adaptive;  /* order is_open() tests the rules in, on the first one when enabled */
+	solar_location location;   /* on the first rule */
+};
+
+/*
+ * Memory used by an opening_hours object, as reported by oh_memory_usage().
+ * total_bytes only accounts for what the object owns, pooled selectors with
+ * the header of their node, and the adaptive order of its rules (see
+ * oh_adaptive_ordering()) in adaptive_bytes. Bytes of bitsets it shares with
+ * other rules or objects, and of the solar table of its location, are
+ * reported apart, in shared_bytes.
+ */
+
+struct oh_memory_stats {
+	size_t total_bytes;
+	size_t rules_bytes;
+	size_t years_bytes;
+	size_t monthdays_bytes;
+	size_t weeks_bytes;
+	size_t weekdays_bytes;
+	size_t hours_bytes;
+	size_t string_bytes;
+	size_t adaptive_bytes;
+	size_t shared_bytes;
+	size_t nb_rules;
+	size_t nb_allocations;
+};
+
+/*
+ * Hot-path counters, only maintained when the library is built with
+ * OH_INSTRUMENT defined (see the Makefile). Each thread owns its own set;
+ * durations are in nanoseconds.
+ */
+
+struct oh_counters {
+	unsigned long is_open_calls;
+	unsigned long rules_scanned;
+	unsigned long max_rules_scanned;
+	unsigned long bitset_probes;
+	unsigned long regex_compilations;
+	unsigned long bitset_allocations;
+	unsigned long bitset_bytes;
+	unsigned long parses;
+	unsigned long wide_range_ns;
+	unsigned long small_range_ns;
+};
+
+/*
+ * 128-bit fingerprint of what a schedule does rather than of how it is
+ * written, stable across runs and platforms (see oh_fingerprint128()).
+ */
+
+struct oh_fingerprint {
+	unsigned long long lo;
+	unsigned long long hi;
+};
+
+/*
+ * Why a string is not valid, as reported by oh_validate(): the message
+ * build_opening_hours() would print, and the byte offset it points at.
+ */
+
+struct oh_error {
+	size_t offset;
+	char message[OH_ERROR_SIZE];
+};
+
+/*
+ * What changed between two versions of a schedule (see
+ * oh_diff_schedules()): UTC intervals, sorted and never touching.
+ */
+
+struct oh_interval {
+	time_t start;
+	time_t end;                 /* excluded */
+};
+
+struct oh_diff {
+	oh_interval *added;         /* open in the new version only */
+	size_t nb_added;
+	oh_interval *removed;       /* open in the old version only */
+	size_t nb_removed;
+};
+
+/*
+ * Allocation functions the library uses instead of libc's (see
+ * oh_set_allocator()), each given context back.
+ */
+
+struct oh_allocator {
+	void *(*malloc)(void *context, size_t size);
+	void *(*calloc)(void *context, size_t nmemb, size_t size);
+	void *(*realloc)(void *context, void *ptr, size_t size);
+	void (*free)(void *context, void *ptr);
+	void *context;
 };
 
 typedef struct when {
@@ -164,9 +323,46 @@ typedef struct when {
 
 char *print_oh(opening_hours);
 opening_hours build_opening_hours(char *);
+int oh_validate(const char *, size_t, oh_error *);
+opening_hours edit_opening_hours(opening_hours, char *, size_t, size_t, char *);
 void free_oh(opening_hours);
 int is_open(opening_hours, when tm);
 int is_open_time(opening_hours, struct tm);
 int is_open_expended(opening_hours, int, int, int, int, int, int);
+int oh_adaptive_ordering(opening_hours, int);
+int oh_set_location(opening_hours, double, double, int);
+int oh_memory_usage(opening_hours, oh_memory_stats *);
+int oh_counters_snapshot(oh_counters *);
+int oh_counters_snapshot_all(oh_counters *);
+void oh_counters_reset(void);
+opening_hours oh_union(opening_hours, opening_hours);
+opening_hours oh_intersection(opening_hours, opening_hours);
+opening_hours oh_difference(opening_hours, opening_hours);
+long oh_open_minutes(opening_hours, time_t, time_t);
+void oh_open_minutes_many(opening_hours *, size_t, time_t, time_t, long *);
+void oh_open_histogram(opening_hours *, size_t, time_t, size_t *, int);
+int oh_open_any(opening_hours, time_t, time_t);
+int oh_open_throughout(opening_hours, time_t, time_t);
+int oh_find_slot(opening_hours, time_t, long, long, time_t *);
+int oh_when_from_days(const long *, size_t, when *, int *, int *);
+int oh_when_from_seconds(const time_t *, size_t, when *, int *, int *);
+int oh_fingerprint128(opening_hours, oh_fingerprint *);
+unsigned long long oh_fingerprint64(opening_hours);
+int oh_equivalent(opening_hours, opening_hours);
+int oh_diff_schedules(opening_hours, opening_hours, time_t, time_t, oh_diff *);
+void oh_diff_free(oh_diff *);
+oh_store *oh_store_new(size_t);
+void oh_store_free(oh_store *);
+int oh_store_put(oh_store *, unsigned long long, opening_hours);
+int oh_store_remove(oh_store *, unsigned long long);
+void oh_store_read_begin(oh_store *);
+void oh_store_read_end(oh_store *);
+opening_hours oh_store_get(oh_store *, unsigned long long);
+int oh_store_is_open(oh_store *, unsigned long long, when);
+size_t oh_store_size(oh_store *);
+long oh_store_load_osm(oh_store *, const char *, const char *, int, size_t *, size_t *);
+void oh_set_allocator(const oh_allocator *);
+void oh_set_thread_allocator(const oh_allocator *);
+const oh_allocator *oh_current_allocator(void);
 
 #endif /* !OPENING_HOURS_H_ */
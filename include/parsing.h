@@ -1,4 +1,5 @@
 #ifndef PARSING_H_
+# define PARSING_H_
 
 # include <ctype.h>
 # include <string.h>
@@ -6,6 +7,8 @@
 # include <regex.h>
 # include "dprintf.h"
 # include "opening_hours.h"
+# include "allocator.h"
+# include "instrument.h"
 
 /*
  * Defining possible return codes of parsing functions
@@ -23,6 +26,7 @@
 
 /* Error check for compiling regexs: */
 # define REG_COMPILE(regex, pattern, opt)  ({ \
+		OH_COUNT(regex_compilations, 1); \
 		if (regcomp(&regex, pattern, opt) < 0) { \
 			dprintf(2, "%s failed in %s:%d", __func__, __FILE__, __LINE__); \
 			dprintf(2, "Regex %s cannot be compiled; aborting.\n", pattern); \
@@ -30,13 +34,113 @@
 		} \
 	})
 
+/*
+ * Validation mode, set by oh_validate() while it runs the grammar: the
+ * parsers then build nothing, and parse_error() records errors in
+ * validating instead of printing them.
+ */
+extern __thread oh_error *validating;
+
+# define VALIDATING  (validating != NULL)
+
+# define PARSE_BITSET(nbits)  (VALIDATING ? NULL : Bitset(nbits))
+
+# define PARSE_SET_BIT(set, index, state)  ({ \
+		if (!VALIDATING) \
+			SET_BIT(set, index, state); \
+	})
+
+# define PARSE_SET_SUBSET(set, from, to, state)  ({ \
+		if (!VALIDATING) \
+			set_subset(set, from, to, state); \
+	})
+
+/* GET_BIT(), counted as a bitset probe in instrumented builds. */
+# define PROBE(set, index) (OH_COUNT(bitset_probes, 1), GET_BIT(set, index))
+
+/*
+ * Whether a rule matches a date, its minute being given apart, as is_open()
+ * sees it. YEARS, MONTHDAYS, WEEKDAYS and EXTENDED tell which selectors to
+ * look at: one no rule constrains is one of the shared all-ones sets (or,
+ * for extended hours, the empty one), so probing it can be skipped.
+ * Comment rules match any date, as for normalize_oh(); week numbers are
+ * not looked at. Years a selector can't hold (before 1900 or after 2923)
+ * only match unconstrained years, so that out of range dates never index
+ * past a bitset. Variable times are left to VARIABLE_MATCHES().
+ */
+# define DATE_MATCHES(selector, date, YEARS, MONTHDAYS)                                                                         \
+	(!((YEARS) || (MONTHDAYS)) || (selector)->wide_range.type == WIDE_RANGE_COMMENT                                         \
+		|| ((!(YEARS) || ((size_t) (date).tm_year < BITSET_SIZE((selector)->wide_range.years)                           \
+					? PROBE((selector)->wide_range.years, (date).tm_year)                                   \
+					: (selector)->wide_range.years == shared_years))                                        \
+			&& (!(MONTHDAYS) || PROBE((selector)->wide_range.monthdays.days,                                        \
+					(date).tm_mon * 32 + (date).tm_mday - 1))))
+
+# define RULE_MATCHES(selector, date, minute, YEARS, MONTHDAYS, WEEKDAYS, EXTENDED)                                             \
+	((selector)->anyway                                                                                                     \
+		|| (DATE_MATCHES(selector, date, YEARS, MONTHDAYS)                                                              \
+			&& (((!(WEEKDAYS) || PROBE((selector)->small_range.weekday.range, WEEKDAY_INDEX((date).tm_wday)))       \
+					&& PROBE((selector)->small_range.hours.time_range, minute))                             \
+				|| ((EXTENDED)                                                                                  \
+					&& (!(WEEKDAYS) || PROBE((selector)->small_range.weekday.range,                         \
+							WEEKDAY_INDEX((date).tm_wday + 6)))                                     \
+					&& PROBE((selector)->small_range.hours.extended_time_range, minute)))))
+
+/* Whether the variable times of a rule (see src/solar.c) match a date, for a schedule at location. */
+# define VARIABLE_MATCHES(selector, location, date, minute)                                                                     \
+	((selector)->small_range.hours.variable && !(selector)->anyway && DATE_MATCHES(selector, date, 1, 1)                    \
+		&& variable_hours_match(location, &(selector)->small_range, (date).tm_mon * 32 + (date).tm_mday - 1,            \
+			WEEKDAY_INDEX((date).tm_wday), minute))
+
+/*
+ * Shared, read-only selectors (see src/parsing.c), given to rules which
+ * leave them unconstrained. is_shared_bitset() tells them apart, as they
+ * must never be written to nor freed.
+ */
+extern bitset const shared_years;
+extern bitset const shared_monthdays;
+extern bitset const shared_weeks;
+extern bitset const shared_weekdays;
+extern bitset const shared_minutes;
+extern bitset const shared_no_minutes;
+
+/*
+ * Pool of the selectors of built rules (see src/pool.c): equal bitsets are
+ * stored once, for every rule and object, and rules hold counted
+ * references to them. As they are never written to, equal selectors are
+ * the same pointer.
+ */
+bitset intern_bitset(bitset);
+void intern_rule(rule_sequence *);
+void release_bitset(bitset);
+size_t bitset_references(bitset);
+size_t bitset_allocated_bytes(bitset, size_t);
+
+/*
+ * Variable times (see src/solar.c): minutes of the solar events at a
+ * location, and of the spans of hours using them.
+ */
+int solar_minute(const solar_location *, int, solar_event);
+bool variable_hours_match(const solar_location *, small_range_selector *, int, int, int);
+void variable_hours_day(const solar_location *, time_selector *, int, bool, bool, _word_t *);
+void release_solar_table(solar_table *);
+size_t solar_table_bytes(const solar_location *);
+
 /*
  * Functions:
  */
 
 char *set_cursor(int, char *);
 char *set_cursor(int, char *);
+size_t adaptive_order_bytes(adaptive_order *, size_t *);
+oh_evaluator bind_adaptive_order(opening_hours, int);
+void clear_adaptive_order(adaptive_order *);
+void bind_evaluator(opening_hours);
+void free_adaptive_order(adaptive_order *);
+void free_rule(rule_sequence *);
+bool is_shared_bitset(bitset);
 int match(char *, char *);
+void parse_error(const char *, ...) __attribute__((format(printf, 1, 2)));
 int parse_monthday_range(monthday_range *, char **);
 int parse_rule_modifier(rule_modifier *, char **);
 int parse_rule_sequence(rule_sequence *, char **);
@@ -47,5 +151,6 @@ int parse_week_selector(bitset *, char **);
 int parse_weekday_selector(weekday_selector *, char **);
 int parse_wide_range_selector(wide_range_selector *, char **);
 int parse_year_range(bitset *, char **);
+int search(char *, char *, regmatch_t *);
 
 #endif /* PARSING_H_ */
@@ -0,0 +1,255 @@
+#include "normalize.h"
+#include "parsing.h"
+
+/*
+ * Adaptive rule ordering (see oh_adaptive_ordering()).
+ *
+ * The first rule matching a date gives the answer of is_open(), so a rule
+ * may only be tested before an earlier one if no date and minute matches
+ * both. Such disjoint pairs are found once, from the selectors. is_open()
+ * then counts the rules matching one call in 2^SAMPLE_SHIFT, and every
+ * REORDER_PERIOD calls tests the most matched first, as far as the
+ * overlapping pairs allow. Calls are counted by each thread, for all the
+ * objects it evaluates: the hot path writes nothing shared.
+ *
+ * Readers never wait: a new order is published as a whole, and the orders
+ * it replaces are only freed with the rules, as a reader may still be
+ * going through them. After MAX_REORDERS changes, the order stays as is.
+ */
+
+#define SAMPLE_SHIFT    4
+/* Calls sampled, spread by Fibonacci hashing so that periodic queries can't all fall beside them. */
+#define SAMPLED(call)   (!(((unsigned long long) (call) * 0x9e3779b97f4a7c15ULL) >> (64 - SAMPLE_SHIFT)))
+#define REORDER_PERIOD  4096
+#define MAX_REORDERS    32
+
+struct adaptive_order {
+	const oh_allocator *allocator;
+	size_t nb_rules;
+	opening_hours *rules;           /* in the order of the list */
+	size_t row_nwords;
+	_word_t *preceding;             /* row i: the earlier rules overlapping rule i */
+	unsigned long *hits;            /* sampled matches of each rule, halved at each reordering */
+	size_t *order;                  /* positions of the rules, in the order they are tested */
+	size_t *retired[MAX_REORDERS];
+	size_t nb_reorders;
+	bool reordering;
+};
+
+static __thread unsigned long calls = 0;
+
+static void release(adaptive_order *a, void *ptr) {
+	if (ptr)
+		a->allocator->free(a->allocator->context, ptr);
+}
+
+/* Frees the order of the rules a was bound to, keeping a itself. */
+void clear_adaptive_order(adaptive_order *a) {
+	size_t i;
+
+	for (i = 0; i < a->nb_reorders; i++)
+		release(a, a->retired[i]);
+	release(a, a->rules);
+	release(a, a->preceding);
+	release(a, a->hits);
+	release(a, a->order);
+	*a = (adaptive_order){.allocator = a->allocator};
+}
+
+static bool intersect(bitset a, bitset b) {
+	size_t nwords = _B_NWORDS(_MIN(BITSET_SIZE(a), BITSET_SIZE(b))), i;
+
+	for (i = 0; i < nwords; i++)
+		if (a[i] & b[i])
+			return (true);
+	return (false);
+}
+
+/* Whether no date and minute matches both rules, given their week profiles. */
+static bool disjoint_rules(rule_sequence *a, rule_sequence *b, _word_t *week_a, _word_t *week_b) {
+	size_t i;
+
+	if (a->selector.anyway || b->selector.anyway)
+		return (false);
+	if (a->selector.wide_range.type == WIDE_RANGE_DATE && b->selector.wide_range.type == WIDE_RANGE_DATE
+			&& (!intersect(a->selector.wide_range.years, b->selector.wide_range.years)
+				|| !intersect(a->selector.wide_range.monthdays.days, b->selector.wide_range.monthdays.days)))
+		return (true);
+	for (i = 0; i < WEEK_NWORDS; i++)
+		if (week_a[i] & week_b[i])
+			return (false);
+	return (true);
+}
+
+/*
+ * Sorts the rules by hits, each one coming after the earlier rules it
+ * overlaps, and publishes the order if it changed. Only one thread
+ * reorders at a time; the others go on with the current order.
+ */
+static void reorder(adaptive_order *a) {
+	size_t n = a->nb_rules, *order, k, i, best;
+	unsigned long hits[n];
+	_word_t *placed;
+
+	if (__atomic_exchange_n(&a->reordering, true, __ATOMIC_ACQUIRE))
+		return;
+	if (a->nb_reorders == MAX_REORDERS) {
+		__atomic_store_n(&a->reordering, false, __ATOMIC_RELEASE);
+		return;
+	}
+	for (i = 0; i < n; i++)
+		hits[i] = __atomic_load_n(&a->hits[i], __ATOMIC_RELAXED);
+	order = calloc_or_die(a->allocator, n, sizeof(*order), "adaptive order");
+	placed = calloc_or_die(a->allocator, a->row_nwords, sizeof(_word_t), "adaptive order");
+	for (k = 0; k < n; k++) {
+		best = n;
+		for (i = 0; i < n; i++) {
+			if (GET_BIT(placed, i) || (best < n && hits[i] <= hits[best]))
+				continue;
+			_bitset_ops->andnot_words(a->preceding + n * a->row_nwords, a->preceding + i * a->row_nwords,
+					placed, a->row_nwords);
+			if (!_bitset_ops->popcount_words(a->preceding + n * a->row_nwords, a->row_nwords))
+				best = i;
+		}
+		order[k] = best;
+		SET_BIT(placed, best, true);
+	}
+	for (i = 0; i < n; i++)
+		__atomic_store_n(&a->hits[i], hits[i] / 2, __ATOMIC_RELAXED);
+	if (memcmp(order, a->order, n * sizeof(*order))) {
+		a->retired[a->nb_reorders++] = a->order;
+		__atomic_store_n(&a->order, order, __ATOMIC_RELEASE);
+	} else {
+		release(a, order);
+	}
+	release(a, placed);
+	__atomic_store_n(&a->reordering, false, __ATOMIC_RELEASE);
+}
+
+/* is_open() through the current order, for each shape of rules (see EVALUATOR() in src/is_open.c). */
+#define ADAPTIVE_EVALUATOR(YEARS, MONTHDAYS, WEEKDAYS, EXTENDED)                                                                \
+static int is_open_adaptive_##YEARS##MONTHDAYS##WEEKDAYS##EXTENDED(opening_hours oh, when date) {                               \
+	adaptive_order *a = oh->adaptive;                                                                                       \
+	size_t *order = __atomic_load_n(&a->order, __ATOMIC_ACQUIRE), k;                                                        \
+	unsigned long call = ++calls;                                                                                           \
+	int minute = date.tm_hour * 60 + date.tm_min,                                                                           \
+	    res = 0;                                                                                                            \
+                                                                                                                                \
+	OH_CALL_BEGIN();                                                                                                        \
+	for (k = 0; k < a->nb_rules; k++) {                                                                                     \
+		OH_RULE_SCANNED();                                                                                              \
+		if (RULE_MATCHES(&a->rules[order[k]]->rule.selector, date, minute, YEARS, MONTHDAYS, WEEKDAYS, EXTENDED)) {     \
+			if (SAMPLED(call))                                                                                      \
+				__atomic_add_fetch(&a->hits[order[k]], 1, __ATOMIC_RELAXED);                                    \
+			res = a->rules[order[k]]->rule.state.type == RULE_OPEN;                                                 \
+			break;                                                                                                  \
+		}                                                                                                               \
+	}                                                                                                                       \
+	if (!(call % REORDER_PERIOD))                                                                                           \
+		reorder(a);                                                                                                     \
+	return (res);                                                                                                           \
+}
+
+ADAPTIVE_EVALUATOR(0, 0, 0, 0)
+ADAPTIVE_EVALUATOR(0, 0, 0, 1)
+ADAPTIVE_EVALUATOR(0, 0, 1, 0)
+ADAPTIVE_EVALUATOR(0, 0, 1, 1)
+ADAPTIVE_EVALUATOR(0, 1, 0, 0)
+ADAPTIVE_EVALUATOR(0, 1, 0, 1)
+ADAPTIVE_EVALUATOR(0, 1, 1, 0)
+ADAPTIVE_EVALUATOR(0, 1, 1, 1)
+ADAPTIVE_EVALUATOR(1, 0, 0, 0)
+ADAPTIVE_EVALUATOR(1, 0, 0, 1)
+ADAPTIVE_EVALUATOR(1, 0, 1, 0)
+ADAPTIVE_EVALUATOR(1, 0, 1, 1)
+ADAPTIVE_EVALUATOR(1, 1, 0, 0)
+ADAPTIVE_EVALUATOR(1, 1, 0, 1)
+ADAPTIVE_EVALUATOR(1, 1, 1, 0)
+ADAPTIVE_EVALUATOR(1, 1, 1, 1)
+
+/* Indexed by years << 3 | monthdays << 2 | weekdays << 1 | extended. */
+static oh_evaluator const adaptive_evaluators[16] = {
+	is_open_adaptive_0000, is_open_adaptive_0001, is_open_adaptive_0010, is_open_adaptive_0011,
+	is_open_adaptive_0100, is_open_adaptive_0101, is_open_adaptive_0110, is_open_adaptive_0111,
+	is_open_adaptive_1000, is_open_adaptive_1001, is_open_adaptive_1010, is_open_adaptive_1011,
+	is_open_adaptive_1100, is_open_adaptive_1101, is_open_adaptive_1110, is_open_adaptive_1111
+};
+
+/*
+ * Starts the order of the rules of oh over, from their order in the list,
+ * finding which of them overlap. Returns the evaluator using it.
+ */
+oh_evaluator bind_adaptive_order(opening_hours oh, int shape) {
+	adaptive_order *a = oh->adaptive;
+	opening_hours cur;
+	_word_t *weeks;
+	size_t i, j;
+
+	clear_adaptive_order(a);
+	for (cur = oh; cur; cur = cur->next_item)
+		++a->nb_rules;
+	a->row_nwords = _B_NWORDS(a->nb_rules);
+	a->rules = calloc_or_die(a->allocator, a->nb_rules, sizeof(*a->rules), "adaptive order");
+	/* One more row, for reorder() to work in. */
+	a->preceding = calloc_or_die(a->allocator, (a->nb_rules + 1) * a->row_nwords, sizeof(_word_t), "adaptive order");
+	a->hits = calloc_or_die(a->allocator, a->nb_rules, sizeof(*a->hits), "adaptive order");
+	a->order = calloc_or_die(a->allocator, a->nb_rules, sizeof(*a->order), "adaptive order");
+	weeks = calloc_or_die(a->allocator, a->nb_rules * WEEK_NWORDS, sizeof(_word_t), "adaptive order");
+	for (cur = oh, i = 0; cur; cur = cur->next_item, i++) {
+		a->rules[i] = cur;
+		a->order[i] = i;
+		rule_week(&cur->rule, weeks + i * WEEK_NWORDS);
+	}
+	for (i = 0; i < a->nb_rules; i++)
+		for (j = 0; j < i; j++)
+			if (!disjoint_rules(&a->rules[j]->rule, &a->rules[i]->rule, weeks + j * WEEK_NWORDS, weeks + i * WEEK_NWORDS))
+				SET_BIT(a->preceding + i * a->row_nwords, j, true);
+	release(a, weeks);
+	return (adaptive_evaluators[shape]);
+}
+
+void free_adaptive_order(adaptive_order *a) {
+	if (!a)
+		return;
+	clear_adaptive_order(a);
+	release(a, a);
+}
+
+/* Bytes allocated for an order, adding the number of allocations to *nb_allocations. */
+size_t adaptive_order_bytes(adaptive_order *a, size_t *nb_allocations) {
+	size_t bytes = sizeof(*a);
+
+	++*nb_allocations;
+	if (a->rules) {
+		bytes += a->nb_rules * (sizeof(*a->rules) + sizeof(*a->hits) + sizeof(*a->order))
+			+ (a->nb_rules + 1) * a->row_nwords * sizeof(_word_t)
+			+ a->nb_reorders * a->nb_rules * sizeof(*a->order);
+		*nb_allocations += 4 + a->nb_reorders;
+	}
+	return (bytes);
+}
+
+/*
+ * Enables adaptive rule ordering for oh (or disables it, given 0):
+ * is_open() then counts which rules match, and from time to time tests
+ * the most matched first, among rules no date and minute can match
+ * together. Answers stay the same. For schedules whose last rules match
+ * most, this saves scanning the others at each call.
+ * Must not be called while other threads use oh. Returns 1, or 0 if oh is
+ * NULL.
+ */
+int oh_adaptive_ordering(opening_hours oh, int enable) {
+	const oh_allocator *allocator = oh_current_allocator();
+
+	if (!oh)
+		return (0);
+	if (enable && !oh->adaptive) {
+		oh->adaptive = calloc_or_die(allocator, 1, sizeof(*oh->adaptive), "adaptive order");
+		oh->adaptive->allocator = allocator;
+	} else if (!enable && oh->adaptive) {
+		free_adaptive_order(oh->adaptive);
+		oh->adaptive = NULL;
+	}
+	bind_evaluator(oh);
+	return (1);
+}
@@ -0,0 +1,36 @@
+#include "normalize.h"
+
+/*
+ * Set algebra over schedules: the result is open exactly when both (or
+ * either, or the first but not the second) operands are. Operands are
+ * compared through their normalized forms, so any rule set may be
+ * combined with any other; the result is made of plain open rules.
+ */
+
+static opening_hours combine(opening_hours a, opening_hours b, normalized_op op) {
+	normalized_oh *na, *nb, *result;
+	opening_hours oh;
+
+	if (!a || !b)
+		return (NULL);
+	na = normalize_oh(a);
+	nb = normalize_oh(b);
+	result = combine_normalized(na, nb, op);
+	oh = normalized_to_oh(result);
+	free_normalized(na);
+	free_normalized(nb);
+	free_normalized(result);
+	return (oh);
+}
+
+opening_hours oh_union(opening_hours a, opening_hours b) {
+	return (combine(a, b, NORMALIZED_OR));
+}
+
+opening_hours oh_intersection(opening_hours a, opening_hours b) {
+	return (combine(a, b, NORMALIZED_AND));
+}
+
+opening_hours oh_difference(opening_hours a, opening_hours b) {
+	return (combine(a, b, NORMALIZED_ANDNOT));
+}
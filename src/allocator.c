@@ -0,0 +1,103 @@
+#include "dprintf.h"
+#include "allocator.h"
+
+/*
+ * Allocator every allocation of the library goes through: libc's, unless
+ * the application sets another one for the whole process, or for a
+ * thread, which then takes precedence. Building the library with
+ * -DOH_DEFAULT_ALLOCATOR=<name> makes the oh_allocator of that name the
+ * default instead of libc's.
+ */
+
+static void *libc_malloc(void *context, size_t size) {
+	(void) context;
+	return (malloc(size));
+}
+
+static void *libc_calloc(void *context, size_t nmemb, size_t size) {
+	(void) context;
+	return (calloc(nmemb, size));
+}
+
+static void *libc_realloc(void *context, void *ptr, size_t size) {
+	(void) context;
+	return (realloc(ptr, size));
+}
+
+static void libc_free(void *context, void *ptr) {
+	(void) context;
+	free(ptr);
+}
+
+static const oh_allocator libc_allocator = {libc_malloc, libc_calloc, libc_realloc, libc_free, NULL};
+
+#ifdef OH_DEFAULT_ALLOCATOR
+extern const oh_allocator OH_DEFAULT_ALLOCATOR;
+# define DEFAULT_ALLOCATOR (&OH_DEFAULT_ALLOCATOR)
+#else
+# define DEFAULT_ALLOCATOR (&libc_allocator)
+#endif /* OH_DEFAULT_ALLOCATOR */
+
+static const oh_allocator *process_allocator = DEFAULT_ALLOCATOR;
+static __thread const oh_allocator *thread_allocator = NULL;
+
+#define CURRENT() (thread_allocator ? thread_allocator : __atomic_load_n(&process_allocator, __ATOMIC_ACQUIRE))
+
+/*
+ * Sets the allocator of the process, or restores the default one given
+ * NULL. It must stay valid while set, and memory must be freed by the
+ * allocator it was allocated by: set it before building any object.
+ */
+void oh_set_allocator(const oh_allocator *allocator) {
+	__atomic_store_n(&process_allocator, allocator ? allocator : DEFAULT_ALLOCATOR, __ATOMIC_RELEASE);
+}
+
+/* Sets the allocator of the calling thread, or falls back to the process one given NULL. */
+void oh_set_thread_allocator(const oh_allocator *allocator) {
+	thread_allocator = allocator;
+}
+
+/* Allocator of the calling thread, for threads working on its behalf. */
+const oh_allocator *oh_current_allocator(void) {
+	return (CURRENT());
+}
+
+void *_oh_malloc(size_t size) {
+	const oh_allocator *allocator = CURRENT();
+
+	return (allocator->malloc(allocator->context, size));
+}
+
+void *_oh_calloc(size_t nmemb, size_t size) {
+	const oh_allocator *allocator = CURRENT();
+
+	return (allocator->calloc(allocator->context, nmemb, size));
+}
+
+void *_oh_realloc(void *ptr, size_t size) {
+	const oh_allocator *allocator = CURRENT();
+
+	return (allocator->realloc(allocator->context, ptr, size));
+}
+
+void _oh_free(void *ptr) {
+	const oh_allocator *allocator = CURRENT();
+
+	if (ptr)
+		allocator->free(allocator->context, ptr);
+}
+
+void *alloc_or_die(void *ptr, const char *what) {
+	if (!ptr) {
+		dprintf(2, "FATAL ERROR: Allocation failed for %s.\nMaybe RAM is full?\n", what);
+		exit(2);
+	}
+	return (ptr);
+}
+
+/* Never asks for 0 bytes, which the allocator may answer with NULL. */
+void *calloc_or_die(const oh_allocator *allocator, size_t nmemb, size_t size, const char *what) {
+	if (!allocator)
+		allocator = CURRENT();
+	return (alloc_or_die(allocator->calloc(allocator->context, nmemb ? nmemb : 1, size ? size : 1), what));
+}
@@ -0,0 +1,254 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "dprintf.h"
+#include "opening_hours.h"
+#include "allocator.h"
+#include "batch.h"
+
+#ifdef STANDALONE
+
+/*
+ * ./libopening-hours --batch [--at <time>] [--format csv|ndjson] [--threads <n>] [file]
+ *
+ * Each line of the input is a schedule, or an id and a schedule separated
+ * by a tab; lines without an id are identified by their line number. Each
+ * gets a result telling whether it is valid and, given a UTC timestamp in
+ * seconds with --at (within OH_MIN_TIME and OH_MAX_TIME, the years
+ * schedules can select), whether it is open then:
+ *
+ *   csv:     id,valid,open                 42,1,0
+ *   ndjson:  {"id":..,"valid":..,"open":..} {"id":"42","valid":true,"open":false}
+ *
+ * The input is read by blocks of lines, which worker threads check by
+ * small chunks; results are then written in input order.
+ */
+
+#define BLOCK_BYTES    (4 << 20)
+#define BLOCK_LINES    65536
+#define CHUNK_LINES    256
+
+typedef enum batch_format {
+	FORMAT_CSV = 0,
+	FORMAT_NDJSON
+} batch_format;
+
+typedef struct batch_line batch_line;
+typedef struct batch batch;
+
+struct batch_line {
+	char *id;          /* NULL when the line has none */
+	char *value;
+	signed char valid;
+	signed char open;  /* -1 when not evaluated */
+};
+
+struct batch {
+	batch_line lines[BLOCK_LINES];
+	size_t nb_lines;
+	size_t next;       /* first line not taken by a worker yet */
+	bool evaluate;
+	struct tm at;
+};
+
+static void check_line(batch *b, batch_line *line) {
+	opening_hours oh = build_opening_hours(line->value);
+
+	line->valid = !!oh;
+	line->open = oh && b->evaluate ? is_open_time(oh, b->at) : -1;
+	free_oh(oh);
+}
+
+static void *worker(void *arg) {
+	batch *b = arg;
+	size_t first, i;
+
+	while ((first = __atomic_fetch_add(&b->next, CHUNK_LINES, __ATOMIC_RELAXED)) < b->nb_lines)
+		for (i = first; i < first + CHUNK_LINES && i < b->nb_lines; i++)
+			check_line(b, &b->lines[i]);
+	return (NULL);
+}
+
+static void check_block(batch *b, pthread_t *threads, size_t nb_threads) {
+	size_t i, started = 0;
+
+	b->next = 0;
+	for (i = 1; i < nb_threads && (i - 1) * CHUNK_LINES < b->nb_lines; i++)
+		if (!pthread_create(&threads[started], NULL, worker, b))
+			++started;
+	worker(b);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+}
+
+static void write_csv_field(FILE *out, const char *s) {
+	if (!strpbrk(s, ",\"\r\n")) {
+		fputs(s, out);
+		return;
+	}
+	putc('"', out);
+	for (; *s; s++) {
+		if (*s == '"')
+			putc('"', out);
+		putc(*s, out);
+	}
+	putc('"', out);
+}
+
+static void write_json_string(FILE *out, const char *s) {
+	putc('"', out);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(out, "\\%c", *s);
+		else if ((unsigned char) *s < 0x20)
+			fprintf(out, "\\u%04x", *s);
+		else
+			putc(*s, out);
+	}
+	putc('"', out);
+}
+
+static void write_results(FILE *out, batch *b, size_t first_number, batch_format format) {
+	static const char *json_open[] = {"null", "false", "true"};
+	batch_line *line;
+	size_t i;
+
+	for (i = 0; i < b->nb_lines; i++) {
+		line = &b->lines[i];
+		if (format == FORMAT_CSV) {
+			if (line->id)
+				write_csv_field(out, line->id);
+			else
+				fprintf(out, "%zu", first_number + i);
+			fprintf(out, ",%d", line->valid);
+			if (b->evaluate)
+				fputs(line->open < 0 ? "," : line->open ? ",1" : ",0", out);
+			putc('\n', out);
+		} else {
+			fputs("{\"id\":", out);
+			if (line->id)
+				write_json_string(out, line->id);
+			else
+				fprintf(out, "%zu", first_number + i);
+			fprintf(out, ",\"valid\":%s", line->valid ? "true" : "false");
+			if (b->evaluate)
+				fprintf(out, ",\"open\":%s", json_open[line->open + 1]);
+			fputs("}\n", out);
+		}
+	}
+}
+
+/* Splits the complete lines of buffer[0..size) into the block, and returns where they end. */
+static size_t split_lines(batch *b, char *buffer, size_t size, bool end) {
+	char *s = buffer, *newline, *tab;
+	batch_line *line;
+
+	b->nb_lines = 0;
+	while (b->nb_lines < BLOCK_LINES && s < buffer + size) {
+		if (!(newline = memchr(s, '\n', buffer + size - s)) && !end)
+			break;
+		if (!newline)
+			newline = buffer + size;
+		*newline = '\0';
+		if (newline > s && newline[-1] == '\r')
+			newline[-1] = '\0';
+		line = &b->lines[b->nb_lines++];
+		if ((tab = strchr(s, '\t'))) {
+			*tab = '\0';
+			line->id = s;
+			line->value = tab + 1;
+		} else {
+			line->id = NULL;
+			line->value = s;
+		}
+		s = newline + 1;
+	}
+	return (_MIN((size_t) (s - buffer), size));
+}
+
+static int usage(void) {
+	dprintf(2, "usage: libopening-hours --batch [--at <time>] [--format csv|ndjson] [--threads <n>] [file]\n");
+	return (2);
+}
+
+int run_batch(int ac, char **av) {
+	batch *b = alloc_or_die(calloc(1, sizeof(*b)), "the batch");
+	batch_format format = FORMAT_CSV;
+	long nb_threads = _MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+	size_t size = 0, capacity = BLOCK_BYTES, used, number = 1;
+	char *buffer, *end, *path = NULL;
+	pthread_t *threads;
+	FILE *in = stdin, *out;
+	long long at;
+	bool eof = false;
+	int i;
+
+	for (i = 0; i < ac; i++) {
+		if (!strcmp(av[i], "--at") && i + 1 < ac) {
+			errno = 0;
+			at = strtoll(av[++i], &end, 10);
+			if (end == av[i] || *end || errno || at < OH_MIN_TIME || at > OH_MAX_TIME
+					|| !gmtime_r(&(time_t){at}, &b->at))
+				return (usage());
+			b->evaluate = true;
+		} else if (!strcmp(av[i], "--format") && i + 1 < ac) {
+			if (!strcmp(av[++i], "csv"))
+				format = FORMAT_CSV;
+			else if (!strcmp(av[i], "ndjson"))
+				format = FORMAT_NDJSON;
+			else
+				return (usage());
+		} else if (!strcmp(av[i], "--threads") && i + 1 < ac) {
+			if ((nb_threads = strtol(av[++i], &end, 10)) < 1 || *end)
+				return (usage());
+		} else if (!path && av[i][0] != '-') {
+			path = av[i];
+		} else {
+			return (usage());
+		}
+	}
+	if (path && !(in = fopen(path, "r"))) {
+		dprintf(2, "%s: %s\n", path, strerror(errno));
+		return (1);
+	}
+	/* Parse errors are printed on stdout: keep them out of the results. */
+	fflush(stdout);
+	if (!(out = fdopen(dup(STDOUT_FILENO), "w")) || dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+		return (1);
+	setvbuf(out, NULL, _IOFBF, 1 << 20);
+	buffer = alloc_or_die(malloc(capacity + 1), "the batch");
+	threads = alloc_or_die(calloc(nb_threads, sizeof(*threads)), "the batch");
+	if (format == FORMAT_CSV)
+		fputs(b->evaluate ? "id,valid,open\n" : "id,valid\n", out);
+	while (!eof || size) {
+		if (!eof && size < capacity) {
+			size += fread(buffer + size, 1, capacity - size, in);
+			eof = feof(in) || ferror(in);
+		}
+		used = split_lines(b, buffer, size, eof);
+		if (!b->nb_lines && !eof) {
+			/* A single line longer than the buffer. */
+			capacity *= 2;
+			buffer = alloc_or_die(realloc(buffer, capacity + 1), "the batch");
+			continue;
+		}
+		check_block(b, threads, nb_threads);
+		write_results(out, b, number, format);
+		number += b->nb_lines;
+		memmove(buffer, buffer + used, size - used);
+		size -= used;
+	}
+	if (in != stdin)
+		fclose(in);
+	free(threads);
+	free(buffer);
+	free(b);
+	return (fclose(out) ? 1 : 0);
+}
+
+#endif /* !STANDALONE */
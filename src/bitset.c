@@ -0,0 +1,342 @@
+/*
+ * Word-array kernels behind the bitset.h operations, in a scalar version
+ * and, on x86, in SSE2, AVX2 and AVX-512 versions. The best version the
+ * CPU supports is selected when the library is loaded.
+ */
+
+#include <string.h>
+#include "allocator.h"
+#include "bitset_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define X86_KERNELS
+#endif /* !__x86_64__ && !__i386__ */
+
+/*
+ * Scalar versions:
+ */
+
+static void and_scalar(_word_t *dest, const _word_t *s1, const _word_t *s2, size_t n) {
+	for (size_t i = 0; i < n; i++)
+		dest[i] = s1[i] & s2[i];
+}
+
+static void or_scalar(_word_t *dest, const _word_t *s1, const _word_t *s2, size_t n) {
+	for (size_t i = 0; i < n; i++)
+		dest[i] = s1[i] | s2[i];
+}
+
+static void xor_scalar(_word_t *dest, const _word_t *s1, const _word_t *s2, size_t n) {
+	for (size_t i = 0; i < n; i++)
+		dest[i] = s1[i] ^ s2[i];
+}
+
+static void andnot_scalar(_word_t *dest, const _word_t *s1, const _word_t *s2, size_t n) {
+	for (size_t i = 0; i < n; i++)
+		dest[i] = s1[i] & ~s2[i];
+}
+
+static void not_scalar(_word_t *dest, const _word_t *src, size_t n) {
+	for (size_t i = 0; i < n; i++)
+		dest[i] = ~src[i];
+}
+
+static bool equal_scalar(const _word_t *s1, const _word_t *s2, size_t n) {
+	for (size_t i = 0; i < n; i++)
+		if (s1[i] != s2[i])
+			return (false);
+	return (true);
+}
+
+static size_t popcount_scalar(const _word_t *set, size_t n) {
+	size_t count = 0;
+
+	for (size_t i = 0; i < n; i++)
+		count += __builtin_popcountll((unsigned long long) set[i])
+			+ __builtin_popcountll((unsigned long long) (set[i] >> 64));
+	return (count);
+}
+
+static void fill_scalar(_word_t *dest, _word_t value, size_t n) {
+	for (size_t i = 0; i < n; i++)
+		dest[i] = value;
+}
+
+static const _bitset_kernels scalar_kernels = {
+	"scalar", and_scalar, or_scalar, xor_scalar, andnot_scalar, not_scalar, equal_scalar, popcount_scalar, fill_scalar
+};
+
+#ifdef X86_KERNELS
+
+/*
+ * SSE2 versions, one word per vector.
+ */
+
+# define LOAD128(p)       _mm_loadu_si128((const __m128i *)(p))
+# define STORE128(p, v)   _mm_storeu_si128((__m128i *)(p), v)
+
+# define SSE2_BINARY(name, expr)                                                                                                \
+static __attribute__((target("sse2")))                                                                                          \
+void name##_sse2(_word_t *dest, const _word_t *s1, const _word_t *s2, size_t n) {                                               \
+	for (size_t i = 0; i < n; i++) {                                                                                        \
+		__m128i a = LOAD128(s1 + i), b = LOAD128(s2 + i);                                                               \
+		STORE128(dest + i, expr);                                                                                       \
+	}                                                                                                                       \
+}
+
+SSE2_BINARY(and, _mm_and_si128(a, b))
+SSE2_BINARY(or, _mm_or_si128(a, b))
+SSE2_BINARY(xor, _mm_xor_si128(a, b))
+SSE2_BINARY(andnot, _mm_andnot_si128(b, a))
+
+static __attribute__((target("sse2")))
+void not_sse2(_word_t *dest, const _word_t *src, size_t n) {
+	__m128i ones = _mm_set1_epi32(-1);
+
+	for (size_t i = 0; i < n; i++)
+		STORE128(dest + i, _mm_xor_si128(LOAD128(src + i), ones));
+}
+
+static __attribute__((target("sse2")))
+bool equal_sse2(const _word_t *s1, const _word_t *s2, size_t n) {
+	for (size_t i = 0; i < n; i++)
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(LOAD128(s1 + i), LOAD128(s2 + i))) != 0xffff)
+			return (false);
+	return (true);
+}
+
+static __attribute__((target("sse2")))
+void fill_sse2(_word_t *dest, _word_t value, size_t n) {
+	__m128i v = LOAD128(&value);
+
+	for (size_t i = 0; i < n; i++)
+		STORE128(dest + i, v);
+}
+
+/*
+ * AVX2 versions, two words per vector. The odd word goes through the low
+ * half of a vector rather than the SSE2 versions, whose legacy encoding
+ * would stall on the AVX state.
+ */
+
+# define LOAD256(p)       _mm256_loadu_si256((const __m256i *)(p))
+# define STORE256(p, v)   _mm256_storeu_si256((__m256i *)(p), v)
+# define LOAD_LOW(p)      _mm256_castsi128_si256(LOAD128(p))
+# define STORE_LOW(p, v)  STORE128(p, _mm256_castsi256_si128(v))
+
+# define AVX2_BINARY(name, expr)                                                                                                \
+static __attribute__((target("avx2")))                                                                                          \
+void name##_avx2(_word_t *dest, const _word_t *s1, const _word_t *s2, size_t n) {                                               \
+	size_t i = 0;                                                                                                           \
+                                                                                                                                \
+	for (; i + 2 <= n; i += 2) {                                                                                            \
+		__m256i a = LOAD256(s1 + i), b = LOAD256(s2 + i);                                                               \
+		STORE256(dest + i, expr);                                                                                       \
+	}                                                                                                                       \
+	if (i < n) {                                                                                                            \
+		__m256i a = LOAD_LOW(s1 + i), b = LOAD_LOW(s2 + i);                                                             \
+		STORE_LOW(dest + i, expr);                                                                                      \
+	}                                                                                                                       \
+}
+
+AVX2_BINARY(and, _mm256_and_si256(a, b))
+AVX2_BINARY(or, _mm256_or_si256(a, b))
+AVX2_BINARY(xor, _mm256_xor_si256(a, b))
+AVX2_BINARY(andnot, _mm256_andnot_si256(b, a))
+
+static __attribute__((target("avx2")))
+void not_avx2(_word_t *dest, const _word_t *src, size_t n) {
+	__m256i ones = _mm256_set1_epi32(-1);
+	size_t i = 0;
+
+	for (; i + 2 <= n; i += 2)
+		STORE256(dest + i, _mm256_xor_si256(LOAD256(src + i), ones));
+	if (i < n)
+		STORE_LOW(dest + i, _mm256_xor_si256(LOAD_LOW(src + i), ones));
+}
+
+static __attribute__((target("avx2")))
+bool equal_avx2(const _word_t *s1, const _word_t *s2, size_t n) {
+	size_t i = 0;
+
+	for (; i + 2 <= n; i += 2)
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(LOAD256(s1 + i), LOAD256(s2 + i))) != -1)
+			return (false);
+	if (i < n)
+		return ((_mm256_movemask_epi8(_mm256_cmpeq_epi8(LOAD_LOW(s1 + i), LOAD_LOW(s2 + i))) & 0xffff) == 0xffff);
+	return (true);
+}
+
+static __attribute__((target("avx2")))
+void fill_avx2(_word_t *dest, _word_t value, size_t n) {
+	__m256i v = _mm256_broadcastsi128_si256(LOAD128(&value));
+	size_t i = 0;
+
+	for (; i + 2 <= n; i += 2)
+		STORE256(dest + i, v);
+	if (i < n)
+		STORE_LOW(dest + i, v);
+}
+
+static __attribute__((target("popcnt")))
+size_t popcount_popcnt(const _word_t *set, size_t n) {
+	size_t count = 0;
+
+	for (size_t i = 0; i < n; i++)
+		count += __builtin_popcountll((unsigned long long) set[i])
+			+ __builtin_popcountll((unsigned long long) (set[i] >> 64));
+	return (count);
+}
+
+/*
+ * AVX-512 versions, four words per vector, the remaining words loaded
+ * and stored through a mask.
+ */
+
+# define TAIL_MASK(n)     ((__mmask8) ((1u << ((n) * 2)) - 1))
+
+# define AVX512_BINARY(name, expr)                                                                                              \
+static __attribute__((target("avx512f")))                                                                                       \
+void name##_avx512(_word_t *dest, const _word_t *s1, const _word_t *s2, size_t n) {                                             \
+	__m512i a, b;                                                                                                           \
+	size_t i = 0;                                                                                                           \
+                                                                                                                                \
+	for (; i + 4 <= n; i += 4) {                                                                                            \
+		a = _mm512_loadu_si512(s1 + i), b = _mm512_loadu_si512(s2 + i);                                                 \
+		_mm512_storeu_si512(dest + i, expr);                                                                            \
+	}                                                                                                                       \
+	if (i < n) {                                                                                                            \
+		a = _mm512_maskz_loadu_epi64(TAIL_MASK(n - i), s1 + i);                                                         \
+		b = _mm512_maskz_loadu_epi64(TAIL_MASK(n - i), s2 + i);                                                         \
+		_mm512_mask_storeu_epi64(dest + i, TAIL_MASK(n - i), expr);                                                     \
+	}                                                                                                                       \
+}
+
+AVX512_BINARY(and, _mm512_and_si512(a, b))
+AVX512_BINARY(or, _mm512_or_si512(a, b))
+AVX512_BINARY(xor, _mm512_xor_si512(a, b))
+AVX512_BINARY(andnot, _mm512_andnot_si512(b, a))
+
+static __attribute__((target("avx512f")))
+void not_avx512(_word_t *dest, const _word_t *src, size_t n) {
+	__m512i ones = _mm512_set1_epi32(-1);
+	size_t i = 0;
+
+	for (; i + 4 <= n; i += 4)
+		_mm512_storeu_si512(dest + i, _mm512_xor_si512(_mm512_loadu_si512(src + i), ones));
+	if (i < n)
+		_mm512_mask_storeu_epi64(dest + i, TAIL_MASK(n - i),
+				_mm512_xor_si512(_mm512_maskz_loadu_epi64(TAIL_MASK(n - i), src + i), ones));
+}
+
+static __attribute__((target("avx512f")))
+bool equal_avx512(const _word_t *s1, const _word_t *s2, size_t n) {
+	size_t i = 0;
+
+	for (; i + 4 <= n; i += 4)
+		if (_mm512_cmpneq_epi64_mask(_mm512_loadu_si512(s1 + i), _mm512_loadu_si512(s2 + i)))
+			return (false);
+	if (i < n)
+		return (!_mm512_cmpneq_epi64_mask(_mm512_maskz_loadu_epi64(TAIL_MASK(n - i), s1 + i),
+					_mm512_maskz_loadu_epi64(TAIL_MASK(n - i), s2 + i)));
+	return (true);
+}
+
+static __attribute__((target("avx512f")))
+void fill_avx512(_word_t *dest, _word_t value, size_t n) {
+	__m512i v = _mm512_broadcast_i32x4(LOAD128(&value));
+	size_t i = 0;
+
+	for (; i + 4 <= n; i += 4)
+		_mm512_storeu_si512(dest + i, v);
+	if (i < n)
+		_mm512_mask_storeu_epi64(dest + i, TAIL_MASK(n - i), v);
+}
+
+static const _bitset_kernels sse2_kernels = {
+	"sse2", and_sse2, or_sse2, xor_sse2, andnot_sse2, not_sse2, equal_sse2, popcount_scalar, fill_sse2
+};
+
+static const _bitset_kernels avx2_kernels = {
+	"avx2", and_avx2, or_avx2, xor_avx2, andnot_avx2, not_avx2, equal_avx2, popcount_popcnt, fill_avx2
+};
+
+static const _bitset_kernels avx512_kernels = {
+	"avx512", and_avx512, or_avx512, xor_avx512, andnot_avx512, not_avx512, equal_avx512, popcount_popcnt, fill_avx512
+};
+
+#endif /* !X86_KERNELS */
+
+/* Kernels in use, scalar until the best ones are selected at load time. */
+const _bitset_kernels *_bitset_ops = &scalar_kernels;
+
+int bitset_select_kernels(const char *name) {
+	const _bitset_kernels *best = &scalar_kernels;
+
+#ifdef X86_KERNELS
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2") && (!name || !strcmp(name, "sse2")))
+		best = &sse2_kernels;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt") && (!name || !strcmp(name, "avx2")))
+		best = &avx2_kernels;
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("popcnt") && (!name || !strcmp(name, "avx512")))
+		best = &avx512_kernels;
+#endif /* !X86_KERNELS */
+	if (name && strcmp(name, best->name))
+		return (0);
+	_bitset_ops = best;
+	return (1);
+}
+
+static __attribute__((constructor)) void select_best_kernels(void) {
+	bitset_select_kernels(NULL);
+}
+
+/*
+ * Out-of-line parts of the bitset.h macros:
+ */
+
+void *_bitset_calloc(size_t nmemb, size_t size) {
+	return (_oh_calloc(nmemb, size));
+}
+
+void *_bitset_realloc(void *ptr, size_t size) {
+	return (_oh_realloc(ptr, size));
+}
+
+void _bitset_free(void *ptr) {
+	_oh_free(ptr);
+}
+
+void _bitset_and_words(_word_t *dest, const _word_t *s1, const _word_t *s2, size_t n) {
+	_bitset_ops->and_words(dest, s1, s2, n);
+}
+
+void _bitset_or_words(_word_t *dest, const _word_t *s1, const _word_t *s2, size_t n) {
+	_bitset_ops->or_words(dest, s1, s2, n);
+}
+
+void _bitset_xor_words(_word_t *dest, const _word_t *s1, const _word_t *s2, size_t n) {
+	_bitset_ops->xor_words(dest, s1, s2, n);
+}
+
+void _bitset_andnot_words(_word_t *dest, const _word_t *s1, const _word_t *s2, size_t n) {
+	_bitset_ops->andnot_words(dest, s1, s2, n);
+}
+
+void _bitset_not_words(_word_t *dest, const _word_t *src, size_t n) {
+	_bitset_ops->not_words(dest, src, n);
+}
+
+bool _bitset_equal_words(const _word_t *s1, const _word_t *s2, size_t n) {
+	return (_bitset_ops->equal_words(s1, s2, n));
+}
+
+size_t _bitset_popcount_words(const _word_t *set, size_t n) {
+	return (_bitset_ops->popcount_words(set, n));
+}
+
+void _bitset_fill_words(_word_t *dest, _word_t value, size_t n) {
+	_bitset_ops->fill_words(dest, value, n);
+}
@@ -0,0 +1,128 @@
+#include <stdint.h>
+#include "opening_hours.h"
+
+/*
+ * Conversion of day numbers and timestamps to dates, without libc.
+ *
+ * Days are converted with Neri and Schneider's algorithm ("Euclidean
+ * affine functions and their application to calendar algorithms", 2022):
+ * only 32-bit multiplications, shifts and divisions by constants, and no
+ * branch. Inputs are converted by blocks, first into plain arrays, which
+ * the compiler can vectorize, then spread into the `when` structures.
+ */
+
+#define BLOCK         256
+
+/* Day 0 is shifted by SHIFT_YEARS years, so that every supported day is a positive 32-bit number. */
+#define SHIFT_YEARS   (400 * 82)
+#define SHIFT_DAYS    (719468 + 146097 * 82)
+
+/* Supported days, keeping a week of margin for the ISO week's Thursday: years -32800 to 2907000. */
+#define MIN_DAY       (7 - SHIFT_DAYS)
+#define MAX_DAY       ((long) (UINT32_MAX / 4) - 7 - SHIFT_DAYS)
+
+#define FLOOR_DIV(a, b) ((a) / (b) - ((a) % (b) < 0))
+
+typedef struct civil civil;
+
+struct civil {
+	int32_t year;       /* Year - 1900               */
+	int32_t month;      /* Month (0-11)              */
+	int32_t mday;       /* Day of the month (1-31)   */
+	int32_t yday;       /* Day of the year (0-365)   */
+};
+
+/* Date of the shifted day n. */
+static inline civil civil_from_shifted(uint32_t n) {
+	uint32_t n1 = 4 * n + 3,
+		 century = n1 / 146097,
+		 n2 = (n1 % 146097) | 3,
+		 year = 100 * century,
+		 day, n3, january;
+	uint64_t p2 = 2939745ULL * n2;
+	uint32_t year_of_century = (uint32_t) (p2 >> 32),
+		 leap = ((year_of_century & 3) == 0) & ((year_of_century != 0) | ((century & 3) == 0));
+
+	/* Days are counted from March 1st, so that February comes last. */
+	day = (uint32_t) p2 / 2939745 / 4;
+	year += year_of_century;
+	n3 = 2141 * day + 197913;
+	january = day >= 306;
+	return ((civil){
+		(int32_t) (year + january) - SHIFT_YEARS - 1900,
+		(int32_t) (n3 >> 16) - 1 - 12 * january,
+		(int32_t) ((n3 & 0xffff) / 2141) + 1,
+		(int32_t) (january ? day - 306 : day + 59 + leap)
+	});
+}
+
+/* Converts a block of days, with the minute of each day, and adds 1 to *bad for days out of range. */
+static void convert_block(const long *days, const int32_t *minutes, size_t n,
+		when *dates, int *iso_weeks, int *year_days, size_t *bad) {
+	uint32_t shifted[BLOCK], thursday;
+	civil dates_civil[BLOCK];
+	int32_t weeks[BLOCK], wdays[BLOCK];
+	size_t i, out = 0;
+
+	for (i = 0; i < n; i++) {
+		out += (unsigned long) (days[i] - MIN_DAY) > (unsigned long) (MAX_DAY - MIN_DAY);
+		shifted[i] = (uint32_t) (days[i] + SHIFT_DAYS);
+		/* Day 0, 1970-01-01, was a Thursday. */
+		wdays[i] = (shifted[i] + 3) % 7;
+		dates_civil[i] = civil_from_shifted(shifted[i]);
+	}
+	/* The ISO week of a day is the one of its week's Thursday, in the year of that Thursday. */
+	if (iso_weeks) {
+		for (i = 0; i < n; i++) {
+			thursday = shifted[i] - (shifted[i] + 2) % 7 + 3;
+			weeks[i] = civil_from_shifted(thursday).yday / 7 + 1;
+		}
+	}
+	for (i = 0; i < n; i++) {
+		dates[i] = (when){{{minutes[i] % 60, minutes[i] / 60, dates_civil[i].mday,
+			dates_civil[i].month, dates_civil[i].year, wdays[i]}}};
+		if (iso_weeks)
+			iso_weeks[i] = weeks[i];
+		if (year_days)
+			year_days[i] = dates_civil[i].yday;
+	}
+	*bad += out;
+}
+
+/*
+ * Fills dates[i] with midnight of the day days[i] after 1970-01-01, in the
+ * proleptic Gregorian calendar. If not NULL, iso_weeks[i] gets its ISO
+ * 8601 week (1-53, as numbered by week selectors) and year_days[i] its day
+ * of the year (0-365).
+ * Returns 1, or 0 if any day was out of the supported range (years -32800
+ * to 2907000), whose dates are then meaningless.
+ */
+int oh_when_from_days(const long *days, size_t n, when *dates, int *iso_weeks, int *year_days) {
+	int32_t minutes[BLOCK] = {0};
+	size_t done, len, bad = 0;
+
+	for (done = 0; done < n; done += len) {
+		len = n - done < BLOCK ? n - done : BLOCK;
+		convert_block(days + done, minutes, len, dates + done,
+				iso_weeks ? iso_weeks + done : NULL, year_days ? year_days + done : NULL, &bad);
+	}
+	return (!bad);
+}
+
+/* Same as oh_when_from_days(), from timestamps read as UTC, to the minute. */
+int oh_when_from_seconds(const time_t *seconds, size_t n, when *dates, int *iso_weeks, int *year_days) {
+	long days[BLOCK];
+	int32_t minutes[BLOCK];
+	size_t done, len, i, bad = 0;
+
+	for (done = 0; done < n; done += len) {
+		len = n - done < BLOCK ? n - done : BLOCK;
+		for (i = 0; i < len; i++) {
+			days[i] = FLOOR_DIV((long) seconds[done + i], 86400);
+			minutes[i] = (int32_t) (((long) seconds[done + i] - days[i] * 86400) / 60);
+		}
+		convert_block(days, minutes, len, dates + done,
+				iso_weeks ? iso_weeks + done : NULL, year_days ? year_days + done : NULL, &bad);
+	}
+	return (!bad);
+}
@@ -0,0 +1,323 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "dprintf.h"
+#include "opening_hours.h"
+#include "allocator.h"
+#include "daemon.h"
+
+#ifdef STANDALONE
+
+/*
+ * Line protocol of the server mode: each request is a line, answered by
+ * exactly one line, in the same order.
+ *
+ *   PARSE <schedule>                 OK | ERR invalid
+ *   OPEN <time> <schedule>           1 | 0 | ERR invalid | ERR bad time
+ *   MINUTES <from> <to> <schedule>   <minutes open> | ERR invalid | ERR bad time
+ *
+ * Times are UTC timestamps in seconds, within the years schedules can
+ * select (OH_MIN_TIME to OH_MAX_TIME). Compiled schedules are cached by
+ * their string (invalid ones too), and the responses to all the requests
+ * of a read are written at once.
+ */
+
+#define CACHE_BUCKETS  4096
+#define CACHE_MAX      (CACHE_BUCKETS * 4)
+#define MAX_LINE       65536
+#define MAX_CLIENTS    64
+#define READ_SIZE      65536
+
+typedef struct cache_entry cache_entry;
+typedef struct client client;
+
+struct cache_entry {
+	char *key;
+	opening_hours oh;
+	cache_entry *next;
+};
+
+struct client {
+	int in;
+	int out;
+	char *line;
+	size_t len;
+	bool skipping;
+	bool ended;
+	char *reply;
+	size_t reply_len;
+	size_t reply_cap;
+};
+
+static cache_entry *cache[CACHE_BUCKETS];
+static size_t cache_size;
+
+/* FNV-1a. */
+static size_t hash_string(const char *s) {
+	size_t h = 2166136261u;
+
+	while (*s)
+		h = (h ^ (unsigned char) *s++) * 16777619u;
+	return (h % CACHE_BUCKETS);
+}
+
+static void flush_cache(void) {
+	cache_entry *entry, *next;
+	size_t i;
+
+	for (i = 0; i < CACHE_BUCKETS; i++) {
+		for (entry = cache[i]; entry; entry = next) {
+			next = entry->next;
+			free_oh(entry->oh);
+			free(entry->key);
+			free(entry);
+		}
+		cache[i] = NULL;
+	}
+	cache_size = 0;
+}
+
+/* Compiled schedule for s, or NULL if it is invalid. Once full, the cache starts over. */
+static opening_hours compile(char *s) {
+	size_t h = hash_string(s);
+	cache_entry *entry;
+
+	for (entry = cache[h]; entry; entry = entry->next)
+		if (!strcmp(entry->key, s))
+			return (entry->oh);
+	if (cache_size == CACHE_MAX)
+		flush_cache();
+	entry = alloc_or_die(malloc(sizeof(*entry)), "the server");
+	entry->key = alloc_or_die(strdup(s), "the server");
+	entry->oh = build_opening_hours(s);
+	entry->next = cache[h];
+	cache[h] = entry;
+	++cache_size;
+	return (entry->oh);
+}
+
+/* Reads a timestamp followed by a space, moving s past them. Times schedules can't select are refused. */
+static bool parse_time(char **s, time_t *t) {
+	char *end;
+	long long value;
+
+	errno = 0;
+	value = strtoll(*s, &end, 10);
+	if (end == *s || *end != ' ' || errno || value < OH_MIN_TIME || value > OH_MAX_TIME)
+		return (false);
+	*t = (time_t) value;
+	*s = end + 1;
+	return (true);
+}
+
+static void reply(client *c, const char *s) {
+	size_t len = strlen(s);
+
+	if (c->reply_len + len + 1 > c->reply_cap) {
+		c->reply_cap = (c->reply_len + len + 1) * 2;
+		c->reply = alloc_or_die(realloc(c->reply, c->reply_cap), "the server");
+	}
+	memcpy(c->reply + c->reply_len, s, len);
+	c->reply[c->reply_len + len] = '\n';
+	c->reply_len += len + 1;
+}
+
+static void handle_request(client *c, char *s) {
+	char buffer[32];
+	opening_hours oh;
+	time_t from, to;
+	when date;
+
+	if (!strncmp(s, "PARSE ", 6)) {
+		reply(c, compile(s + 6) ? "OK" : "ERR invalid");
+	} else if (!strncmp(s, "OPEN ", 5)) {
+		s += 5;
+		if (!parse_time(&s, &from) || !oh_when_from_seconds(&from, 1, &date, NULL, NULL))
+			reply(c, "ERR bad time");
+		else if (!(oh = compile(s)))
+			reply(c, "ERR invalid");
+		else
+			reply(c, is_open(oh, date) ? "1" : "0");
+	} else if (!strncmp(s, "MINUTES ", 8)) {
+		s += 8;
+		if (!parse_time(&s, &from) || !parse_time(&s, &to)) {
+			reply(c, "ERR bad time");
+		} else if (!(oh = compile(s))) {
+			reply(c, "ERR invalid");
+		} else {
+			snprintf(buffer, sizeof(buffer), "%ld", oh_open_minutes(oh, from, to));
+			reply(c, buffer);
+		}
+	} else {
+		reply(c, "ERR unknown request");
+	}
+}
+
+/* Writes the pending responses, keeping what a non-blocking client cannot take yet. */
+static int flush_replies(client *c) {
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < c->reply_len) {
+		if ((n = write(c->out, c->reply + done, c->reply_len - done)) >= 0)
+			done += n;
+		else if (errno == EAGAIN || errno == EWOULDBLOCK)
+			break;
+		else if (errno != EINTR)
+			return (-1);
+	}
+	memmove(c->reply, c->reply + done, c->reply_len - done);
+	c->reply_len -= done;
+	return (0);
+}
+
+/*
+ * Answers the complete lines among the n bytes read (all of them at the
+ * end of the input), then writes the whole batch of responses.
+ */
+static int handle_input(client *c, const char *data, size_t n, bool end) {
+	const char *newline;
+	size_t size;
+
+	while (n || (end && (c->len || c->skipping))) {
+		newline = memchr(data, '\n', n);
+		size = newline ? (size_t) (newline - data) : n;
+		if (!c->skipping && c->len + size < MAX_LINE) {
+			memcpy(c->line + c->len, data, size);
+			c->len += size;
+		} else {
+			c->skipping = true;
+		}
+		data += size + !!newline;
+		n -= size + !!newline;
+		if (!newline && !end)
+			break;
+		if (c->skipping) {
+			reply(c, "ERR line too long");
+		} else {
+			if (c->len && c->line[c->len - 1] == '\r')
+				--c->len;
+			c->line[c->len] = '\0';
+			handle_request(c, c->line);
+		}
+		c->len = 0;
+		c->skipping = false;
+	}
+	return (flush_replies(c));
+}
+
+static client *new_client(int in, int out) {
+	client *c = alloc_or_die(calloc(1, sizeof(*c)), "the server");
+
+	c->in = in;
+	c->out = out;
+	c->line = alloc_or_die(malloc(MAX_LINE), "the server");
+	return (c);
+}
+
+static void free_client(client *c) {
+	free(c->line);
+	free(c->reply);
+	free(c);
+}
+
+/*
+ * Writes what is pending for the client, or else reads from it once.
+ * Returns 1 while it has more to say or to be told, 0 once done, -1 on error.
+ */
+static int serve_client(client *c, char *buffer) {
+	ssize_t n;
+
+	if (c->reply_len) {
+		if (flush_replies(c) < 0)
+			return (-1);
+	} else if (!c->ended) {
+		if ((n = read(c->in, buffer, READ_SIZE)) < 0)
+			return (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK ? 1 : -1);
+		c->ended = !n;
+		if (handle_input(c, buffer, n, c->ended) < 0)
+			return (-1);
+	}
+	return (c->reply_len || !c->ended);
+}
+
+int serve_stream(int in, int out) {
+	char *buffer = alloc_or_die(malloc(READ_SIZE), "the server");
+	client *c;
+	int res;
+
+	/* Parse errors are printed on stdout: keep them out of the responses. */
+	if (out == STDOUT_FILENO) {
+		fflush(stdout);
+		if ((out = dup(STDOUT_FILENO)) < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+			return (-1);
+	}
+	c = new_client(in, out);
+	signal(SIGPIPE, SIG_IGN);
+	while ((res = serve_client(c, buffer)) > 0);
+	free_client(c);
+	free(buffer);
+	flush_cache();
+	return (res);
+}
+
+int serve_socket(const char *path) {
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	struct pollfd fds[MAX_CLIENTS + 1];
+	client *clients[MAX_CLIENTS + 1] = {NULL};
+	char *buffer;
+	int fd, nfds = 1, i;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		dprintf(2, "%s: socket path too long\n", path);
+		return (-1);
+	}
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+		|| bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+		|| listen(fd, MAX_CLIENTS) < 0) {
+		dprintf(2, "%s: %s\n", path, strerror(errno));
+		return (-1);
+	}
+	signal(SIGPIPE, SIG_IGN);
+	buffer = alloc_or_die(malloc(READ_SIZE), "the server");
+	fds[0] = (struct pollfd){.fd = fd, .events = POLLIN};
+	while (1) {
+		if (poll(fds, nfds, -1) < 0)
+			continue;
+		for (i = nfds - 1; i > 0; i--) {
+			if (!fds[i].revents)
+				continue;
+			if (serve_client(clients[i], buffer) > 0) {
+				/* Clients not reading their responses are not read either. */
+				fds[i].events = clients[i]->reply_len ? POLLOUT : POLLIN;
+				continue;
+			}
+			close(fds[i].fd);
+			free_client(clients[i]);
+			fds[i] = fds[--nfds];
+			clients[i] = clients[nfds];
+		}
+		if (!(fds[0].revents & POLLIN) || (fd = accept(fds[0].fd, NULL, NULL)) < 0)
+			continue;
+		if (nfds > MAX_CLIENTS) {
+			close(fd);
+			continue;
+		}
+		fcntl(fd, F_SETFL, O_NONBLOCK);
+		fds[nfds] = (struct pollfd){.fd = fd, .events = POLLIN};
+		clients[nfds++] = new_client(fd, fd);
+	}
+}
+
+#endif /* !STANDALONE */
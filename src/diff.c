@@ -0,0 +1,104 @@
+#include <string.h>
+#include "normalize.h"
+
+/*
+ * Changes between two versions of a schedule: the minutes the new one is
+ * open and the old one is not (added), and the reverse (removed).
+ *
+ * Both versions are normalized and XORed: the week profiles of the result
+ * are empty wherever they behave the same, so a day without changes costs
+ * a look at DAY_NWORDS words. The changed minutes of the other days are
+ * split with the profile of the new version, then turned into intervals.
+ */
+
+#define FLOOR_DIV(a, b) ((a) / (b) - ((a) % (b) < 0))
+
+typedef struct interval_list interval_list;
+
+struct interval_list {
+	oh_interval *intervals;
+	size_t nb;
+	size_t capacity;
+};
+
+/* Appends [start, end) to list, merging it with the last interval when they touch. */
+static void push_interval(interval_list *list, time_t start, time_t end) {
+	if (list->nb && list->intervals[list->nb - 1].end == start) {
+		list->intervals[list->nb - 1].end = end;
+		return;
+	}
+	if (list->nb == list->capacity) {
+		list->capacity = list->capacity ? list->capacity * 2 : 16;
+		list->intervals = alloc_or_die(_oh_realloc(list->intervals, list->capacity * sizeof(*list->intervals)), "oh_diff");
+	}
+	list->intervals[list->nb++] = (oh_interval){start, end};
+}
+
+/* Pushes the runs of bits set among the [from, to) minutes of a day starting at minute first. */
+static void push_runs(interval_list *list, _word_t *day, long first, size_t from, size_t to) {
+	size_t start, end;
+
+	bitset_runs(day, from, to, start, end)
+		push_interval(list, (time_t) (first + start) * 60, (time_t) (first + end) * 60);
+}
+
+static _word_t *normalized_day(normalized_oh *n, when *date) {
+	return (NORMALIZED_WEEK(n, n->year_class[date->tm_year], n->monthday_class[date->tm_mon * 32 + date->tm_mday - 1])
+			+ WEEKDAY_INDEX(date->tm_wday) * DAY_NWORDS);
+}
+
+/*
+ * Fills diff with the changes from before to after, for the minutes
+ * starting in [from, to), UTC. Dates out of the years schedules can select
+ * (1900 to 2923) are left out. Returns 1, or 0 if a schedule is NULL.
+ * The intervals must be freed with oh_diff_free().
+ */
+int oh_diff_schedules(opening_hours before, opening_hours after, time_t from, time_t to, oh_diff *diff) {
+	long first = FLOOR_DIV((long) from + 59, 60),
+	     last = FLOOR_DIV((long) to + 59, 60),
+	     day;
+	interval_list added = {0}, removed = {0};
+	normalized_oh *old, *new, *changed;
+	_word_t part[DAY_NWORDS], *changes, *now;
+	size_t lo, hi;
+	when date;
+
+	if (!diff)
+		return (0);
+	memset(diff, 0, sizeof(*diff));
+	if (!before || !after)
+		return (0);
+	old = normalize_oh(before);
+	new = normalize_oh(after);
+	changed = combine_normalized(old, new, NORMALIZED_XOR);
+	for (day = FLOOR_DIV(first, DAY_MINUTES); day * DAY_MINUTES < last; day++) {
+		if (!oh_when_from_days(&day, 1, &date, NULL, NULL) || date.tm_year < 0 || date.tm_year >= NB_YEARS)
+			continue;
+		changes = normalized_day(changed, &date);
+		if (!_bitset_ops->popcount_words(changes, DAY_NWORDS))
+			continue;
+		lo = first > day * DAY_MINUTES ? first - day * DAY_MINUTES : 0;
+		hi = last < (day + 1) * DAY_MINUTES ? last - day * DAY_MINUTES : DAY_MINUTES;
+		now = normalized_day(new, &date);
+		_bitset_ops->and_words(part, changes, now, DAY_NWORDS);
+		push_runs(&added, part, day * DAY_MINUTES, lo, hi);
+		_bitset_ops->andnot_words(part, changes, now, DAY_NWORDS);
+		push_runs(&removed, part, day * DAY_MINUTES, lo, hi);
+	}
+	free_normalized(old);
+	free_normalized(new);
+	free_normalized(changed);
+	diff->added = added.intervals;
+	diff->nb_added = added.nb;
+	diff->removed = removed.intervals;
+	diff->nb_removed = removed.nb;
+	return (1);
+}
+
+void oh_diff_free(oh_diff *diff) {
+	if (!diff)
+		return;
+	_oh_free(diff->added);
+	_oh_free(diff->removed);
+	memset(diff, 0, sizeof(*diff));
+}
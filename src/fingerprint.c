@@ -0,0 +1,82 @@
+#include <string.h>
+#include "normalize.h"
+
+/*
+ * Fingerprints and equivalence of schedules, computed from their
+ * normalized forms: two objects behaving the same at every minute get the
+ * same fingerprint, however their rules are written.
+ *
+ * The hash only reads values, 64 bits at a time, never raw memory, so a
+ * fingerprint is the same from one run, build or platform to another.
+ */
+
+#define PRIME_1 0x9e3779b185ebca87ULL
+#define PRIME_2 0xc2b2ae3d27d4eb4fULL
+#define ROTL(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static void feed(oh_fingerprint *fp, unsigned long long value) {
+	fp->lo = ROTL(fp->lo ^ value, 31) * PRIME_1;
+	fp->hi = ROTL(fp->hi ^ value, 27) * PRIME_2 + fp->lo;
+}
+
+/* MurmurHash3's finalizer. */
+static unsigned long long avalanche(unsigned long long h) {
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	return (h ^ (h >> 33));
+}
+
+static void feed_words(oh_fingerprint *fp, _word_t *words, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		feed(fp, (unsigned long long) words[i]);
+		feed(fp, (unsigned long long) (words[i] >> 64));
+	}
+}
+
+int oh_fingerprint128(opening_hours oh, oh_fingerprint *fp) {
+	normalized_oh *n;
+	size_t i;
+
+	if (!oh || !fp || !(n = normalize_oh(oh)))
+		return (0);
+	fp->lo = PRIME_1;
+	fp->hi = PRIME_2;
+	feed(fp, n->nb_years);
+	feed(fp, n->nb_monthdays);
+	for (i = 0; i < NB_YEARS; i++)
+		feed(fp, n->year_class[i]);
+	for (i = 0; i < NB_MONTHDAYS; i++)
+		feed(fp, n->monthday_class[i]);
+	feed_words(fp, n->weeks, n->nb_years * n->nb_monthdays * WEEK_NWORDS);
+	fp->lo = avalanche(fp->lo);
+	fp->hi = avalanche(fp->hi ^ fp->lo);
+	free_normalized(n);
+	return (1);
+}
+
+unsigned long long oh_fingerprint64(opening_hours oh) {
+	oh_fingerprint fp = {0, 0};
+
+	oh_fingerprint128(oh, &fp);
+	return (fp.lo);
+}
+
+/* Returns 1 if both objects are open at exactly the same minutes, 0 otherwise. */
+int oh_equivalent(opening_hours a, opening_hours b) {
+	normalized_oh *na, *nb;
+	int res;
+
+	if (!a || !b)
+		return (a == b);
+	na = normalize_oh(a);
+	nb = normalize_oh(b);
+	res = na->nb_years == nb->nb_years && na->nb_monthdays == nb->nb_monthdays
+		&& !memcmp(na->year_class, nb->year_class, sizeof(na->year_class))
+		&& !memcmp(na->monthday_class, nb->monthday_class, sizeof(na->monthday_class))
+		&& _bitset_ops->equal_words(na->weeks, nb->weeks, na->nb_years * na->nb_monthdays * WEEK_NWORDS);
+	free_normalized(na);
+	free_normalized(nb);
+	return (res);
+}
@@ -0,0 +1,132 @@
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include "normalize.h"
+
+/*
+ * Number of schedules open at each minute of a week (see
+ * oh_open_histogram()).
+ *
+ * Rather than asking is_open() for each schedule and minute, each day of
+ * a schedule gets its profile of open minutes (see day_profile()), which
+ * is added to vertical counters: bit k of the count of a minute is held
+ * by slice k, so adding a profile is a ripple carry over whole words,
+ * rarely going past the first slices. The counts are only read back, bit
+ * by bit, once the slices could overflow, or at the end.
+ *
+ * Worker threads take chunks of schedules in turn, each with its own
+ * counters, and add them to the histogram with atomic additions.
+ */
+
+#define NB_SLICES       16
+#define MAX_COUNT       ((1 << NB_SLICES) - 1)
+#define CHUNK_OHS       64
+/* A week not starting at midnight spans 8 days. */
+#define SPAN_DAYS       8
+#define SPAN_NWORDS     (SPAN_DAYS * DAY_NWORDS)
+
+#define FLOOR_DIV(a, b) ((a) / (b) - ((a) % (b) < 0))
+
+typedef struct histogram histogram;
+
+struct histogram {
+	opening_hours *ohs;
+	size_t n;
+	size_t *counts;
+	when dates[SPAN_DAYS];
+	int monthdays[SPAN_DAYS];
+	size_t offset;         /* minute of its first day the week starts at */
+	size_t next;           /* first schedule not taken by a worker yet */
+};
+
+/* Adds a day profile to the counters of a day. */
+static void add_day(_word_t (*slices)[SPAN_NWORDS], size_t first_word, const _word_t *profile) {
+	_word_t carry, overflow;
+	size_t i, k;
+
+	for (i = 0; i < DAY_NWORDS; i++) {
+		carry = profile[i];
+		for (k = 0; carry && k < NB_SLICES; k++) {
+			overflow = slices[k][first_word + i] & carry;
+			slices[k][first_word + i] ^= carry;
+			carry = overflow;
+		}
+	}
+}
+
+/* Adds the counters to the histogram and clears them. */
+static void flush_counters(histogram *h, _word_t (*slices)[SPAN_NWORDS]) {
+	size_t minute, span_minute, count, k;
+
+	for (minute = 0; minute < OH_WEEK_MINUTES; minute++) {
+		span_minute = h->offset + minute;
+		count = 0;
+		for (k = 0; k < NB_SLICES; k++)
+			count |= (size_t) GET_BIT(slices[k] + span_minute / DAY_MINUTES * DAY_NWORDS, span_minute % DAY_MINUTES) << k;
+		if (count)
+			__atomic_add_fetch(&h->counts[minute], count, __ATOMIC_RELAXED);
+	}
+	memset(slices, 0, NB_SLICES * sizeof(*slices));
+}
+
+static void *worker(void *arg) {
+	histogram *h = arg;
+	_word_t slices[NB_SLICES][SPAN_NWORDS] = {{0}}, profile[DAY_NWORDS];
+	size_t first, i, added = 0;
+	int day;
+
+	while ((first = __atomic_fetch_add(&h->next, CHUNK_OHS, __ATOMIC_RELAXED)) < h->n) {
+		for (i = first; i < _MIN(first + CHUNK_OHS, h->n); i++) {
+			if (!h->ohs[i])
+				continue;
+			for (day = 0; day < SPAN_DAYS; day++) {
+				if (day == SPAN_DAYS - 1 && !h->offset)
+					break;
+				day_profile(h->ohs[i], h->dates[day].tm_year, h->monthdays[day], WEEKDAY_INDEX(h->dates[day].tm_wday),
+						profile);
+				add_day(slices, day * DAY_NWORDS, profile);
+			}
+			if (++added == MAX_COUNT) {
+				flush_counters(h, slices);
+				added = 0;
+			}
+		}
+	}
+	if (added)
+		flush_counters(h, slices);
+	return (NULL);
+}
+
+/*
+ * Fills counts[i], for i below OH_WEEK_MINUTES, with the number of the n
+ * schedules ohs open at the minute starting i minutes after from (or after
+ * the first minute following it), UTC. NULL schedules are skipped. Uses
+ * nb_threads threads, or one per CPU if it is not positive.
+ */
+void oh_open_histogram(opening_hours *ohs, size_t n, time_t from, size_t *counts, int nb_threads) {
+	long first = FLOOR_DIV((long) from + 59, 60),
+	     days[SPAN_DAYS];
+	histogram h = {.ohs = ohs, .n = n, .counts = counts};
+	pthread_t *threads;
+	int i, started = 0;
+
+	memset(counts, 0, OH_WEEK_MINUTES * sizeof(*counts));
+	h.offset = first - FLOOR_DIV(first, DAY_MINUTES) * DAY_MINUTES;
+	for (i = 0; i < SPAN_DAYS; i++)
+		days[i] = FLOOR_DIV(first, DAY_MINUTES) + i;
+	oh_when_from_days(days, SPAN_DAYS, h.dates, NULL, NULL);
+	for (i = 0; i < SPAN_DAYS; i++)
+		h.monthdays[i] = h.dates[i].tm_mon * 32 + h.dates[i].tm_mday - 1;
+	if (nb_threads <= 0)
+		nb_threads = _MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+	nb_threads = _MIN((size_t) nb_threads, n / CHUNK_OHS + 1);
+	if ((threads = _oh_malloc(nb_threads * sizeof(*threads))))
+		for (i = 1; i < nb_threads; i++)
+			if (!pthread_create(&threads[started], NULL, worker, &h))
+				++started;
+	worker(&h);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	_oh_free(threads);
+}
@@ -0,0 +1,109 @@
+#ifdef OH_INSTRUMENT
+# define _POSIX_C_SOURCE 200809L
+# include <pthread.h>
+#endif /* !OH_INSTRUMENT */
+#include <string.h>
+#include "instrument.h"
+
+#ifdef OH_INSTRUMENT
+
+__thread oh_thread_counters oh_thread_counters_;
+
+/*
+ * Every thread which ever counted something is linked in threads, so that
+ * oh_counters_snapshot_all() can sum them up. When a thread exits, its
+ * counters are folded into retired before its storage disappears.
+ */
+static oh_thread_counters *threads = NULL;
+static oh_counters retired;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_key;
+
+static void add_counters(oh_counters *to, oh_counters *from, unsigned long current) {
+	to->is_open_calls += from->is_open_calls;
+	to->rules_scanned += from->rules_scanned;
+	to->max_rules_scanned = _MAX(to->max_rules_scanned, _MAX(from->max_rules_scanned, current));
+	to->bitset_probes += from->bitset_probes;
+	to->regex_compilations += from->regex_compilations;
+	to->bitset_allocations += from->bitset_allocations;
+	to->bitset_bytes += from->bitset_bytes;
+	to->parses += from->parses;
+	to->wide_range_ns += from->wide_range_ns;
+	to->small_range_ns += from->small_range_ns;
+}
+
+static void unregister_thread(void *data) {
+	oh_thread_counters *thread = data,
+			   **cur;
+
+	pthread_mutex_lock(&threads_lock);
+	add_counters(&retired, &thread->counters, thread->current_rules_scanned);
+	for (cur = &threads; *cur; cur = &(*cur)->next) {
+		if (*cur == thread) {
+			*cur = thread->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&threads_lock);
+}
+
+static void create_key(void) {
+	pthread_key_create(&thread_key, unregister_thread);
+}
+
+void oh_instrument_register(void) {
+	pthread_once(&key_once, create_key);
+	pthread_mutex_lock(&threads_lock);
+	oh_thread_counters_.registered = true;
+	oh_thread_counters_.next = threads;
+	threads = &oh_thread_counters_;
+	pthread_mutex_unlock(&threads_lock);
+	pthread_setspecific(thread_key, &oh_thread_counters_);
+}
+
+unsigned long oh_instrument_clock(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec * 1000000000UL + now.tv_nsec);
+}
+
+int oh_counters_snapshot(oh_counters *counters) {
+	memset(counters, 0, sizeof(*counters));
+	add_counters(counters, &oh_thread_counters_.counters, oh_thread_counters_.current_rules_scanned);
+	return (1);
+}
+
+int oh_counters_snapshot_all(oh_counters *counters) {
+	oh_thread_counters *cur;
+
+	pthread_mutex_lock(&threads_lock);
+	*counters = retired;
+	for (cur = threads; cur; cur = cur->next)
+		add_counters(counters, &cur->counters, cur->current_rules_scanned);
+	pthread_mutex_unlock(&threads_lock);
+	return (1);
+}
+
+void oh_counters_reset(void) {
+	memset(&oh_thread_counters_.counters, 0, sizeof(oh_thread_counters_.counters));
+	oh_thread_counters_.current_rules_scanned = 0;
+}
+
+#else
+
+int oh_counters_snapshot(oh_counters *counters) {
+	memset(counters, 0, sizeof(*counters));
+	return (0);
+}
+
+int oh_counters_snapshot_all(oh_counters *counters) {
+	memset(counters, 0, sizeof(*counters));
+	return (0);
+}
+
+void oh_counters_reset(void) {
+}
+
+#endif /* !OH_INSTRUMENT */
@@ -1,25 +1,114 @@
-#include "opening_hours.h"
+#include "parsing.h"
+#include "instrument.h"
 
-int is_open(opening_hours oh, when date) {
-	if (!oh)
-		return (0);
+/*
+ * Evaluators of is_open(), one for each shape of schedule: which of the
+ * years, monthdays, weekdays and extended hours its rules constrain (see
+ * RULE_MATCHES()). The generic evaluator, checking everything, is
+ * EVALUATOR(1, 1, 1, 1).
+ */
+#define EVALUATOR(YEARS, MONTHDAYS, WEEKDAYS, EXTENDED)                                                                         \
+static int is_open_##YEARS##MONTHDAYS##WEEKDAYS##EXTENDED(opening_hours oh, when date) {                                        \
+	opening_hours cur = oh;                                                                                                 \
+	int minute = date.tm_hour * 60 + date.tm_min;                                                                           \
+                                                                                                                                \
+	OH_CALL_BEGIN();                                                                                                        \
+	do {                                                                                                                    \
+		OH_RULE_SCANNED();                                                                                              \
+		if (RULE_MATCHES(&cur->rule.selector, date, minute, YEARS, MONTHDAYS, WEEKDAYS, EXTENDED))                      \
+			return (cur->rule.state.type == RULE_OPEN);                                                             \
+	} while ((cur = cur->next_item));                                                                                       \
+	return (0);                                                                                                             \
+}
+
+EVALUATOR(0, 0, 0, 0)
+EVALUATOR(0, 0, 0, 1)
+EVALUATOR(0, 0, 1, 0)
+EVALUATOR(0, 0, 1, 1)
+EVALUATOR(0, 1, 0, 0)
+EVALUATOR(0, 1, 0, 1)
+EVALUATOR(0, 1, 1, 0)
+EVALUATOR(0, 1, 1, 1)
+EVALUATOR(1, 0, 0, 0)
+EVALUATOR(1, 0, 0, 1)
+EVALUATOR(1, 0, 1, 0)
+EVALUATOR(1, 0, 1, 1)
+EVALUATOR(1, 1, 0, 0)
+EVALUATOR(1, 1, 0, 1)
+EVALUATOR(1, 1, 1, 0)
+EVALUATOR(1, 1, 1, 1)
+
+/* Indexed by years << 3 | monthdays << 2 | weekdays << 1 | extended. */
+static oh_evaluator const evaluators[16] = {
+	is_open_0000, is_open_0001, is_open_0010, is_open_0011,
+	is_open_0100, is_open_0101, is_open_0110, is_open_0111,
+	is_open_1000, is_open_1001, is_open_1010, is_open_1011,
+	is_open_1100, is_open_1101, is_open_1110, is_open_1111
+};
+
+/* For schedules whose first rule applies anyway (24/7, or no selector at all). */
+static int is_open_always(opening_hours oh, when date) {
+	(void) date;
+	OH_CALL_BEGIN();
+	OH_RULE_SCANNED();
+	return (oh->rule.state.type == RULE_OPEN);
+}
+
+/* For schedules with variable times, whose every selector is checked. */
+static int is_open_variable(opening_hours oh, when date) {
 	opening_hours cur = oh;
+	int minute = date.tm_hour * 60 + date.tm_min;
 
+	OH_CALL_BEGIN();
 	do {
-		selector_sequence selector = cur->rule.selector;
-
-		if (selector.anyway
-				|| (GET_BIT(selector.wide_range.years, date.tm_year)
-					&& GET_BIT(selector.wide_range.monthdays.days, date.tm_mon * 32 + date.tm_mday - 1)
-					&& ((GET_BIT(selector.small_range.weekday.range, date.tm_wday)
-						&& GET_BIT(selector.small_range.hours.time_range, date.tm_hour * 60 + date.tm_min))
-					|| (GET_BIT(selector.small_range.weekday.range, date.tm_wday - 1 < 0 ? 6 : date.tm_wday - 1)
-						&& GET_BIT(selector.small_range.hours.extended_time_range, date.tm_hour * 60 + date.tm_min)))))
+		OH_RULE_SCANNED();
+		if (RULE_MATCHES(&cur->rule.selector, date, minute, 1, 1, 1, 1)
+				|| VARIABLE_MATCHES(&cur->rule.selector, &oh->location, date, minute))
 			return (cur->rule.state.type == RULE_OPEN);
 	} while ((cur = cur->next_item));
 	return (0);
 }
 
+/*
+ * Classifies the rules of oh and binds the evaluator of their shape.
+ * To be called again whenever they change.
+ */
+void bind_evaluator(opening_hours oh) {
+	opening_hours cur;
+	bool variable = false;
+	int shape = 0;
+
+	if (!oh)
+		return;
+	for (cur = oh; cur; cur = cur->next_item) {
+		selector_sequence *selector = &cur->rule.selector;
+
+		if (selector->anyway)
+			continue;
+		variable |= selector->small_range.hours.variable != NULL;
+		if (selector->wide_range.type == WIDE_RANGE_DATE)
+			shape |= (selector->wide_range.years != shared_years) << 3
+				| (selector->wide_range.monthdays.days != shared_monthdays) << 2;
+		shape |= (selector->small_range.weekday.range != shared_weekdays) << 1
+			| (selector->small_range.hours.extended_time_range != shared_no_minutes);
+	}
+	/* Adaptive ordering relies on week profiles, which variable times don't have: their order is left unbound. */
+	if (oh->adaptive && (variable || oh->rule.selector.anyway))
+		clear_adaptive_order(oh->adaptive);
+	if (oh->rule.selector.anyway)
+		oh->evaluate = is_open_always;
+	else if (variable)
+		oh->evaluate = is_open_variable;
+	else
+		oh->evaluate = oh->adaptive ? bind_adaptive_order(oh, shape) : evaluators[shape];
+}
+
+int is_open(opening_hours oh, when date) {
+	if (!oh)
+		return (0);
+	return ((oh->evaluate ? oh->evaluate : is_open_1111)(oh, date));
+}
+
 int is_open_time(opening_hours oh, struct tm date) {
 	return (is_open(oh, *((when *)&date.tm_min)));
 }
@@ -6,17 +6,49 @@
 # include <ctype.h>
 
 #include "parsing.h"
+#include "daemon.h"
+#include "batch.h"
 
 #ifdef STANDALONE
 
+static void print_memory_usage(opening_hours oh) {
+	oh_memory_stats stats;
+
+	if (!oh_memory_usage(oh, &stats))
+		return;
+	printf("--------   MEMORY  --------\n");
+	printf("  Rules:      %zu (%zu bytes)\n", stats.nb_rules, stats.rules_bytes);
+	printf("  Years:      %zu bytes\n", stats.years_bytes);
+	printf("  Monthdays:  %zu bytes\n", stats.monthdays_bytes);
+	printf("  Weeknums:   %zu bytes\n", stats.weeks_bytes);
+	printf("  Weekdays:   %zu bytes\n", stats.weekdays_bytes);
+	printf("  Hours:      %zu bytes\n", stats.hours_bytes);
+	printf("  Dump:       %zu bytes\n", stats.string_bytes);
+	printf("  Adaptive:   %zu bytes\n", stats.adaptive_bytes);
+	printf("  Shared:     %zu bytes\n", stats.shared_bytes);
+	printf("  Total:      %zu bytes in %zu allocations\n\n", stats.total_bytes, stats.nb_allocations);
+}
+
+/*
+ * ./libopening-hours <schedule>          prints how the schedule is parsed.
+ * ./libopening-hours --serve [socket]    answers requests (see src/daemon.c)
+ *                                        on stdin, or on a Unix socket.
+ * ./libopening-hours --batch [...]       checks each line of a file (see
+ *                                        src/batch.c).
+ */
 int main(int ac, char **av) {
 	char *printed;
 	opening_hours oh;
 
+	if (ac > 1 && !strcmp(av[1], "--batch"))
+		return (run_batch(ac - 2, av + 2));
+	if (ac > 1 && !strcmp(av[1], "--serve"))
+		return ((ac > 2 ? serve_socket(av[2]) : serve_stream(0, 1)) ? 1 : 0);
 	if (ac > 1) {
 		oh = build_opening_hours(av[1]);
 		printed = print_oh(oh);
 		printf("%s", printed);
+		print_memory_usage(oh);
 		free_oh(oh);
 	}
 	return (0);
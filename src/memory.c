@@ -0,0 +1,67 @@
+#include <string.h>
+#include "parsing.h"
+
+static size_t account_bitset(oh_memory_stats *stats, bitset set) {
+	size_t references, bytes;
+
+	if (!set)
+		return (0);
+	if (is_shared_bitset(set)) {
+		stats->shared_bytes += BITSET_NBYTES(set);
+		return (0);
+	}
+	references = bitset_references(set);
+	bytes = bitset_allocated_bytes(set, references);
+	if (references > 1) {
+		stats->shared_bytes += bytes;
+		return (0);
+	}
+	++stats->nb_allocations;
+	return (bytes);
+}
+
+int oh_memory_usage(opening_hours oh, oh_memory_stats *stats) {
+	opening_hours cur = oh;
+
+	if (!stats)
+		return (0);
+	memset(stats, 0, sizeof(*stats));
+	if (!oh)
+		return (0);
+
+	if (oh->adaptive)
+		stats->adaptive_bytes = adaptive_order_bytes(oh->adaptive, &stats->nb_allocations);
+	stats->shared_bytes += solar_table_bytes(&oh->location);
+	do {
+		selector_sequence selector = cur->rule.selector;
+
+		++stats->nb_rules;
+		++stats->nb_allocations;
+		stats->rules_bytes += sizeof(*cur);
+		if (selector.wide_range.type == WIDE_RANGE_DATE) {
+			stats->years_bytes += account_bitset(stats, selector.wide_range.years);
+			stats->monthdays_bytes += account_bitset(stats, selector.wide_range.monthdays.days);
+			stats->weeks_bytes += account_bitset(stats, selector.wide_range.weeks);
+		}
+		stats->weekdays_bytes += account_bitset(stats, selector.small_range.weekday.range);
+		stats->hours_bytes += account_bitset(stats, selector.small_range.hours.time_range);
+		stats->hours_bytes += account_bitset(stats, selector.small_range.hours.extended_time_range);
+		if (selector.small_range.hours.variable) {
+			++stats->nb_allocations;
+			stats->hours_bytes += selector.small_range.hours.nb_variable * sizeof(variable_span);
+		}
+		if (cur->to_str) {
+			++stats->nb_allocations;
+			stats->string_bytes += strlen(cur->to_str) + 1;
+		}
+	} while ((cur = cur->next_item));
+	stats->total_bytes = stats->rules_bytes
+		+ stats->years_bytes
+		+ stats->monthdays_bytes
+		+ stats->weeks_bytes
+		+ stats->weekdays_bytes
+		+ stats->hours_bytes
+		+ stats->string_bytes
+		+ stats->adaptive_bytes;
+	return (1);
+}
@@ -0,0 +1,191 @@
+#include <string.h>
+#include "normalize.h"
+
+/*
+ * Open time analytics. Rather than asking is_open() minute after minute,
+ * each day of the range gets its profile of open minutes (see
+ * day_profile()), whose bits are then counted: the cost grows with the
+ * number of days and rules, not with the number of minutes.
+ */
+
+#define FLOOR_DIV(a, b) ((a) / (b) - ((a) % (b) < 0))
+
+/* Number of bits set among the [from, to) minutes of a day profile. */
+static size_t count_minutes(_word_t *day, size_t from, size_t to) {
+	_word_t masked[DAY_NWORDS];
+	size_t i;
+
+	if (!from && to == DAY_MINUTES)
+		return (_bitset_ops->popcount_words(day, DAY_NWORDS));
+	for (i = 0; i < DAY_NWORDS; i++)
+		masked[i] = i < _B_INDEX(from) || i > _B_INDEX(to) ? 0 : day[i];
+	masked[_B_INDEX(from)] &= ~ (_word_t) 0 << _B_OFFSET(from);
+	if (_B_INDEX(to) < DAY_NWORDS)
+		masked[_B_INDEX(to)] &= ~(~ (_word_t) 0 << _B_OFFSET(to));
+	return (_bitset_ops->popcount_words(masked, DAY_NWORDS));
+}
+
+/*
+ * Fills minutes[i] with the number of minutes ohs[i] is open, counting the
+ * minutes starting in [from, to). Timestamps are read as UTC: shift them by
+ * the zone offset for schedules given in local time. Each day is converted
+ * once for all the objects.
+ */
+void oh_open_minutes_many(opening_hours *ohs, size_t n, time_t from, time_t to, long *minutes) {
+	long first = FLOOR_DIV((long) from + 59, 60),
+	     last = FLOOR_DIV((long) to + 59, 60),
+	     day;
+	_word_t profile[DAY_NWORDS];
+	size_t lo, hi, i;
+	when date;
+
+	memset(minutes, 0, n * sizeof(*minutes));
+	for (day = FLOOR_DIV(first, DAY_MINUTES); day * DAY_MINUTES < last; day++) {
+		lo = first > day * DAY_MINUTES ? first - day * DAY_MINUTES : 0;
+		hi = last < (day + 1) * DAY_MINUTES ? last - day * DAY_MINUTES : DAY_MINUTES;
+		oh_when_from_days(&day, 1, &date, NULL, NULL);
+		for (i = 0; i < n; i++) {
+			if (!ohs[i])
+				continue;
+			day_profile(ohs[i], date.tm_year, date.tm_mon * 32 + date.tm_mday - 1, WEEKDAY_INDEX(date.tm_wday), profile);
+			minutes[i] += count_minutes(profile, lo, hi);
+		}
+	}
+}
+
+long oh_open_minutes(opening_hours oh, time_t from, time_t to) {
+	long minutes;
+
+	oh_open_minutes_many(&oh, 1, from, to, &minutes);
+	return (minutes);
+}
+
+enum window_query {
+	OPEN_ANY,
+	OPEN_THROUGHOUT
+};
+
+static bool leap_year(long year) {
+	return (!(year % 4) && ((year % 100) || !(year % 400)));
+}
+
+/* Number of days from monthday to the day before the end monthday index, in year. */
+static long days_between(long year, int monthday, int end) {
+	long days = 0;
+
+	for (; monthday < end; monthday++)
+		if (valid_monthday(monthday) && (monthday != 32 + 28 || leap_year(year)))
+			++days;
+	return (days);
+}
+
+/*
+ * Days selected by the same rules behave the same for each day of the
+ * week, so once a full week of a run of such days has been checked, the
+ * rest of the run is skipped: the cost depends on the number of changes
+ * of rules crossed by the window rather than on its length.
+ */
+static int window_query(opening_hours oh, time_t from, time_t to, enum window_query query) {
+	long first = FLOOR_DIV((long) from + 59, 60),
+	     last = FLOOR_DIV((long) to + 59, 60),
+	     last_full = FLOOR_DIV(last, DAY_MINUTES),
+	     day, run_end = 0, checked = 0;
+	_word_t profile[DAY_NWORDS];
+	size_t lo, hi, open;
+	int monthday;
+	when date;
+
+	if (!oh || first >= last)
+		return (0);
+	for (day = FLOOR_DIV(first, DAY_MINUTES); day * DAY_MINUTES < last;) {
+		lo = first > day * DAY_MINUTES ? first - day * DAY_MINUTES : 0;
+		hi = last < (day + 1) * DAY_MINUTES ? last - day * DAY_MINUTES : DAY_MINUTES;
+		oh_when_from_days(&day, 1, &date, NULL, NULL);
+		monthday = date.tm_mon * 32 + date.tm_mday - 1;
+		if (day >= run_end) {
+			run_end = day + days_between(date.tm_year + 1900, monthday, next_selection_change(oh, date.tm_year, monthday));
+			checked = 0;
+		}
+		day_profile(oh, date.tm_year, monthday, WEEKDAY_INDEX(date.tm_wday), profile);
+		open = count_minutes(profile, lo, hi);
+		if (query == OPEN_ANY && open)
+			return (1);
+		if (query == OPEN_THROUGHOUT && open != hi - lo)
+			return (0);
+		if (hi - lo == DAY_MINUTES && ++checked == 7 && run_end < last_full)
+			day = run_end;
+		else if (hi - lo == DAY_MINUTES && checked >= 7)
+			day = _MAX(day + 1, last_full);
+		else
+			++day;
+	}
+	return (query == OPEN_THROUGHOUT);
+}
+
+/* Returns 1 if oh is open at any minute starting in [from, to), UTC. */
+int oh_open_any(opening_hours oh, time_t from, time_t to) {
+	return (window_query(oh, from, to, OPEN_ANY));
+}
+
+/* Returns 1 if oh is open at every minute starting in [from, to), UTC; 0 for an empty window. */
+int oh_open_throughout(opening_hours oh, time_t from, time_t to) {
+	return (window_query(oh, from, to, OPEN_THROUGHOUT));
+}
+
+/*
+ * Earliest start of a slot of at least duration minutes oh is open
+ * throughout, among the minutes starting in the horizon minutes following
+ * from, UTC: the slot must end by then. Open minutes are read in runs off
+ * the day profiles, a run reaching midnight going on into the next day.
+ * In a run of days selected by the same rules, once a week starting and
+ * ending closed at midnight has been scanned, the next ones, which behave
+ * the same, are skipped.
+ * Returns 1, setting *start, if there is such a slot; 0 otherwise.
+ */
+int oh_find_slot(opening_hours oh, time_t from, long duration, long horizon, time_t *start) {
+	long first = FLOOR_DIV((long) from + 59, 60),
+	     last = FLOOR_DIV((long) from + horizon * 60 + 59, 60),
+	     last_full = FLOOR_DIV(last, DAY_MINUTES),
+	     day, run_end = 0, week = -1, skip, carried = -1, run_start;
+	_word_t profile[DAY_NWORDS];
+	size_t lo, hi, run_from, run_to;
+	int monthday;
+	when date;
+
+	if (!oh || !start || duration < 1 || first >= last)
+		return (0);
+	for (day = FLOOR_DIV(first, DAY_MINUTES); day * DAY_MINUTES < last;) {
+		lo = first > day * DAY_MINUTES ? first - day * DAY_MINUTES : 0;
+		hi = last < (day + 1) * DAY_MINUTES ? last - day * DAY_MINUTES : DAY_MINUTES;
+		oh_when_from_days(&day, 1, &date, NULL, NULL);
+		monthday = date.tm_mon * 32 + date.tm_mday - 1;
+		if (day >= run_end) {
+			run_end = day + days_between(date.tm_year + 1900, monthday, next_selection_change(oh, date.tm_year, monthday));
+			week = -1;
+		}
+		if (carried < 0 && !lo) {
+			if (week >= 0 && day - week == 7 && (skip = (_MIN(run_end, last_full) - day) / 7 * 7)) {
+				day += skip;
+				week = day;
+				continue;
+			}
+			if (week < 0 || day - week >= 7)
+				week = day;
+		}
+		day_profile(oh, date.tm_year, monthday, WEEKDAY_INDEX(date.tm_wday), profile);
+		run_start = carried;
+		carried = -1;
+		bitset_runs(profile, lo, hi, run_from, run_to) {
+			if (run_from || run_start < 0)
+				run_start = day * DAY_MINUTES + run_from;
+			if (day * DAY_MINUTES + (long) run_to - run_start >= duration) {
+				*start = (time_t) run_start * 60;
+				return (1);
+			}
+			if (run_to == DAY_MINUTES)
+				carried = run_start;
+		}
+		++day;
+	}
+	return (0);
+}
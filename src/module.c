@@ -1,190 +1,342 @@
-/* Generated by Pyrex 0.9.9 on Fri Jul 22 11:52:27 2016 */
+/*
+ * CPython 3 bindings.
+ *
+ * Exposes compiled schedules as opening_hours.Schedule objects:
+ *
+ *   >>> import opening_hours
+ *   >>> s = opening_hours.Schedule("Mo-Fr 09:00-18:00")
+ *   >>> s.is_open(datetime.datetime(2016, 7, 21, 12, 24))
+ *   True
+ *   >>> s.is_open_many(numpy.array([1469103840, 1469147040]))
+ *   <memory at 0x...>
+ *
+ * is_open_many() accepts any one-dimensional buffer of UTC timestamps
+ * (integers or floats, in seconds) and returns a memoryview of booleans,
+ * filled without holding the GIL. numpy.asarray() turns it into a bool
+ * array without copying it.
+ *
+ * Instants must fall in the years schedules can select (1900 to 2923);
+ * others raise ValueError. A Schedule can't be initialized twice, so that
+ * its compiled schedule stays valid while is_open_many() runs without the
+ * GIL.
+ */
 
 #define PY_SSIZE_T_CLEAN
-#include "Python.h"
-#include "structmember.h"
-#ifndef PY_LONG_LONG
-  #define PY_LONG_LONG LONG_LONG
-#endif
-#if PY_VERSION_HEX < 0x02050000
-  typedef int Py_ssize_t;
-  #define PY_SSIZE_T_MAX INT_MAX
-  #define PY_SSIZE_T_MIN INT_MIN
-  #define PyInt_FromSsize_t(z) PyInt_FromLong(z)
-  #define PyInt_AsSsize_t(o)	PyInt_AsLong(o)
-#endif
-#if !defined(WIN32) && !defined(MS_WINDOWS)
-  #ifndef __stdcall
-    #define __stdcall
-  #endif
-  #ifndef __cdecl
-    #define __cdecl
-  #endif
-#endif
-#ifdef __cplusplus
-#define __PYX_EXTERN_C extern "C"
-#else
-#define __PYX_EXTERN_C extern
-#endif
-#include <math.h>
-#include "../include/opening_hours.h"
+#include <Python.h>
+#include <string.h>
+#include <time.h>
+#include "opening_hours.h"
 
+/* Largest shift between two instants schedules can select: */
+#define TIME_SPAN  (OH_MAX_TIME - OH_MIN_TIME)
 
-typedef struct {PyObject **p; int i; char *s; long n;} __Pyx_StringTabEntry; /*proto*/
+typedef struct {
+	PyObject_HEAD
+	opening_hours oh;
+	PyObject *source;
+} Schedule;
 
-static PyObject *__pyx_m;
-static PyObject *__pyx_b;
-static int __pyx_lineno;
-static char *__pyx_filename;
-static char **__pyx_f;
+static PyTypeObject ScheduleType;
 
-static int __Pyx_InitStrings(__Pyx_StringTabEntry *t); /*proto*/
+static int schedule_init(Schedule *self, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = {"value", NULL};
+	PyObject *source;
+	opening_hours oh;
 
-static void __Pyx_AddTraceback(char *funcname); /*proto*/
+	if (self->oh) {
+		PyErr_SetString(PyExc_TypeError, "Schedule is already initialized");
+		return (-1);
+	}
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "U", kwlist, &source))
+		return (-1);
+	oh = build_opening_hours((char *)PyUnicode_AsUTF8(source));
+	if (!oh) {
+		PyErr_Format(PyExc_ValueError, "invalid opening_hours value: %R", source);
+		return (-1);
+	}
+	Py_INCREF(source);
+	self->source = source;
+	self->oh = oh;
+	return (0);
+}
 
-/* Declarations from module */
+static void schedule_dealloc(Schedule *self) {
+	free_oh(self->oh);
+	Py_XDECREF(self->source);
+	Py_TYPE(self)->tp_free((PyObject *)self);
+}
 
+static PyObject *schedule_str(Schedule *self) {
+	PyObject *source = self->source ? self->source : Py_None;
 
-/* Declarations from implementation of module */
+	Py_INCREF(source);
+	return (source);
+}
 
+static PyObject *schedule_repr(Schedule *self) {
+	return (PyUnicode_FromFormat("Schedule(%R)", self->source ? self->source : Py_None));
+}
 
+static int check_schedule(Schedule *self) {
+	if (!self->oh) {
+		PyErr_SetString(PyExc_ValueError, "uninitialized Schedule");
+		return (0);
+	}
+	return (1);
+}
 
+static int out_of_range(void) {
+	PyErr_SetString(PyExc_ValueError, "instant out of the years 1900 to 2923");
+	return (0);
+}
 
+/* Returns the broken down UTC time of a Python datetime or timestamp. */
+static int instant_to_tm(PyObject *instant, struct tm *date) {
+	static const char *names[] = {"minute", "hour", "day", "month", "year"};
+	int *fields[] = {&date->tm_min, &date->tm_hour, &date->tm_mday, &date->tm_mon, &date->tm_year};
+	PyObject *value;
+	long long seconds;
+	double real;
+	time_t t;
 
-static __Pyx_StringTabEntry __pyx_string_tab[] = {
-  {0, 0, 0, 0}
-};
+	if (PyLong_Check(instant)) {
+		seconds = PyLong_AsLongLong(instant);
+		if (PyErr_Occurred() && !PyErr_ExceptionMatches(PyExc_OverflowError))
+			return (0);
+		if (PyErr_Occurred() || seconds < OH_MIN_TIME || seconds > OH_MAX_TIME) {
+			PyErr_Clear();
+			return (out_of_range());
+		}
+		t = seconds;
+		gmtime_r(&t, date);
+		return (1);
+	}
+	if (PyFloat_Check(instant)) {
+		real = PyFloat_AsDouble(instant);
+		if (!(real >= OH_MIN_TIME && real <= OH_MAX_TIME))
+			return (out_of_range());
+		t = (time_t)real;
+		gmtime_r(&t, date);
+		return (1);
+	}
+	memset(date, 0, sizeof(*date));
+	if (!(value = PyObject_CallMethod(instant, "isoweekday", NULL)))
+		return (0);
+	date->tm_wday = PyLong_AsLong(value) % 7;
+	Py_DECREF(value);
+	for (size_t i = 0; i < sizeof(names) / sizeof(*names); i++) {
+		if (!(value = PyObject_GetAttrString(instant, names[i])))
+			return (0);
+		*fields[i] = PyLong_AsLong(value);
+		Py_DECREF(value);
+	}
+	if (PyErr_Occurred())
+		return (0);
+	if (date->tm_year < 1900 || date->tm_year > 2923)
+		return (out_of_range());
+	date->tm_mon -= 1;
+	date->tm_year -= 1900;
+	return (1);
+}
+
+static PyObject *schedule_is_open(Schedule *self, PyObject *instant) {
+	struct tm date;
 
+	if (!check_schedule(self) || !instant_to_tm(instant, &date))
+		return (NULL);
+	return (PyBool_FromLong(is_open_time(self->oh, date)));
+}
 
+/* Native element types accepted for timestamps, '@' and '=' prefixes stripped. */
+static int timestamp_format(Py_buffer *view) {
+	const char *format = view->format ? view->format : "B";
 
-/* Implementation of module */
-
-static PyObject *__pyx_f_6module_build(PyObject *__pyx_self, PyObject *__pyx_args, PyObject *__pyx_kwds); /*proto*/
-static PyObject *__pyx_f_6module_build(PyObject *__pyx_self, PyObject *__pyx_args, PyObject *__pyx_kwds) {
-  PyObject *__pyx_v_s = 0;
-  PyObject *__pyx_r;
-  char *__pyx_1;
-  PyObject *__pyx_2 = 0;
-  static char *__pyx_argnames[] = {"s",0};
-  if (!PyArg_ParseTupleAndKeywords(__pyx_args, __pyx_kwds, "O", __pyx_argnames, &__pyx_v_s)) return 0;
-  Py_INCREF(__pyx_v_s);
-  __pyx_1 = PyString_AsString(__pyx_v_s); if (!__pyx_1) {__pyx_filename = __pyx_f[0]; __pyx_lineno = 5; goto __pyx_L1;}
-  __pyx_2 = PyString_FromString(build_opening_hours(__pyx_1)); if (!__pyx_2) {__pyx_filename = __pyx_f[0]; __pyx_lineno = 5; goto __pyx_L1;}
-  __pyx_r = __pyx_2;
-  __pyx_2 = 0;
-  goto __pyx_L0;
-
-  __pyx_r = Py_None; Py_INCREF(Py_None);
-  goto __pyx_L0;
-  __pyx_L1:;
-  Py_XDECREF(__pyx_2);
-  __Pyx_AddTraceback("module.build");
-  __pyx_r = 0;
-  __pyx_L0:;
-  Py_DECREF(__pyx_v_s);
-  return __pyx_r;
+	if (*format == '@' || *format == '=' || (*format == '<' && PY_LITTLE_ENDIAN) || (*format == '>' && PY_BIG_ENDIAN))
+		++format;
+	if (format[0] && format[1])
+		return (0);
+	if (!strchr("bhilqBHILQfd", format[0]))
+		return (0);
+	return (format[0]);
 }
 
-static struct PyMethodDef __pyx_methods[] = {
-  {"build", (PyCFunction)__pyx_f_6module_build, METH_VARARGS|METH_KEYWORDS, 0},
-  {0, 0, 0, 0}
-};
+/*
+ * Reads timestamp i into *t, shifted by offset (within TIME_SPAN of 0).
+ * Returns 0 if it falls out of the years schedules can select, or is not a
+ * number, before any conversion could overflow.
+ */
+static int timestamp_at(const char *data, Py_ssize_t i, int format, long long offset, time_t *t) {
+	unsigned long long unsigned_value = 0;
+	long long value = 0;
+	double real = 0;
 
-static void __pyx_init_filenames(void); /*proto*/
-
-PyMODINIT_FUNC initmodule(void); /*proto*/
-PyMODINIT_FUNC initmodule(void) {
-  __pyx_init_filenames();
-  __pyx_m = Py_InitModule4("module", __pyx_methods, 0, 0, PYTHON_API_VERSION);
-  if (!__pyx_m) {__pyx_filename = __pyx_f[0]; __pyx_lineno = 1; goto __pyx_L1;};
-  Py_INCREF(__pyx_m);
-  __pyx_b = PyImport_AddModule("__builtin__");
-  if (!__pyx_b) {__pyx_filename = __pyx_f[0]; __pyx_lineno = 1; goto __pyx_L1;};
-  if (PyObject_SetAttrString(__pyx_m, "__builtins__", __pyx_b) < 0) {__pyx_filename = __pyx_f[0]; __pyx_lineno = 1; goto __pyx_L1;};
-  if (__Pyx_InitStrings(__pyx_string_tab) < 0) {__pyx_filename = __pyx_f[0]; __pyx_lineno = 1; goto __pyx_L1;};
-
-  /* "/home/asphahyre/Projects/C_OpeningHours/src/module.pyx":4 */
-  return;
-  __pyx_L1:;
-  __Pyx_AddTraceback("module");
+	switch (format) {
+		case 'b': value = ((const signed char *)data)[i]; break;
+		case 'h': value = ((const short *)data)[i]; break;
+		case 'i': value = ((const int *)data)[i]; break;
+		case 'l': value = ((const long *)data)[i]; break;
+		case 'q': value = ((const long long *)data)[i]; break;
+		case 'B': unsigned_value = ((const unsigned char *)data)[i]; break;
+		case 'H': unsigned_value = ((const unsigned short *)data)[i]; break;
+		case 'I': unsigned_value = ((const unsigned int *)data)[i]; break;
+		case 'L': unsigned_value = ((const unsigned long *)data)[i]; break;
+		case 'Q': unsigned_value = ((const unsigned long long *)data)[i]; break;
+		case 'f': real = ((const float *)data)[i]; break;
+		default:  real = ((const double *)data)[i]; break;
+	}
+	if (strchr("BHILQ", format)) {
+		if (unsigned_value > (unsigned long long)TIME_SPAN)
+			return (0);
+		value = (long long)unsigned_value;
+	} else if (format == 'f' || format == 'd') {
+		if (!(real >= -TIME_SPAN && real <= TIME_SPAN))
+			return (0);
+		value = (long long)real;
+	} else if (value < -TIME_SPAN || value > TIME_SPAN) {
+		return (0);
+	}
+	value += offset;
+	if (value < OH_MIN_TIME || value > OH_MAX_TIME)
+		return (0);
+	*t = value;
+	return (1);
 }
 
-static char *__pyx_filenames[] = {
-  "module.pyx",
-};
+static PyObject *schedule_is_open_many(Schedule *self, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = {"timestamps", "out", "offset", NULL};
+	PyObject *timestamps, *out = Py_None, *result = NULL, *storage = NULL, *view;
+	Py_buffer in, res;
+	long long offset = 0;
+	int format;
+
+	if (!check_schedule(self)
+			|| !PyArg_ParseTupleAndKeywords(args, kwds, "O|OL", kwlist, &timestamps, &out, &offset))
+		return (NULL);
+	if (offset < -TIME_SPAN || offset > TIME_SPAN) {
+		PyErr_SetString(PyExc_ValueError, "offset out of range");
+		return (NULL);
+	}
+	if (PyObject_GetBuffer(timestamps, &in, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) < 0)
+		return (NULL);
+	if (in.ndim > 1 || !(format = timestamp_format(&in))) {
+		PyErr_Format(PyExc_TypeError, "expected a one-dimensional buffer of numbers, got format '%s'", in.format);
+		goto release_in;
+	}
+	if (out == Py_None) {
+		if (!(storage = PyByteArray_FromStringAndSize(NULL, in.len / in.itemsize)))
+			goto release_in;
+		out = storage;
+	}
+	if (PyObject_GetBuffer(out, &res, PyBUF_C_CONTIGUOUS | PyBUF_WRITABLE) < 0)
+		goto release_storage;
+	if (res.len != in.len / in.itemsize || (res.itemsize != 1)) {
+		PyErr_SetString(PyExc_ValueError, "out must be a writable buffer of one byte per timestamp");
+		goto release_res;
+	}
 
-/* Runtime support code */
+	{
+		const char *data = in.buf;
+		unsigned char *flags = res.buf;
+		Py_ssize_t n = res.len, bad = -1;
+		opening_hours oh = self->oh;
+		struct tm date;
+		time_t t;
 
-static void __pyx_init_filenames(void) {
-  __pyx_f = __pyx_filenames;
+		Py_BEGIN_ALLOW_THREADS
+		for (Py_ssize_t i = 0; i < n; i++) {
+			if (!timestamp_at(data, i, format, offset, &t)) {
+				bad = i;
+				break;
+			}
+			gmtime_r(&t, &date);
+			flags[i] = is_open_time(oh, date);
+		}
+		Py_END_ALLOW_THREADS
+		if (bad >= 0) {
+			PyErr_Format(PyExc_ValueError, "timestamp %zd out of the years 1900 to 2923", bad);
+			goto release_res;
+		}
+	}
+
+	if (storage) {
+		if ((view = PyMemoryView_FromObject(storage))) {
+			result = PyObject_CallMethod(view, "cast", "s", "?");
+			Py_DECREF(view);
+		}
+	} else {
+		Py_INCREF(out);
+		result = out;
+	}
+release_res:
+	PyBuffer_Release(&res);
+release_storage:
+	Py_XDECREF(storage);
+release_in:
+	PyBuffer_Release(&in);
+	return (result);
+}
+
+static PyObject *schedule_dump(Schedule *self, PyObject *Py_UNUSED(ignored)) {
+	if (!check_schedule(self))
+		return (NULL);
+	return (PyUnicode_FromString(print_oh(self->oh)));
 }
 
-static int __Pyx_InitStrings(__Pyx_StringTabEntry *t) {
-    while (t->p) {
-        *t->p = PyString_FromStringAndSize(t->s, t->n - 1);
-        if (!*t->p)
-            return -1;
-        if (t->i)
-            PyString_InternInPlace(t->p);
-        ++t;
-    }
-    return 0;
+static PyMethodDef schedule_methods[] = {
+	{"is_open", (PyCFunction)schedule_is_open, METH_O,
+		"is_open(instant) -> bool\n\nInstant is a datetime, or a UTC timestamp in seconds."},
+	{"is_open_many", (PyCFunction)(void (*)(void))schedule_is_open_many, METH_VARARGS | METH_KEYWORDS,
+		"is_open_many(timestamps, out=None, offset=0) -> memoryview\n\n"
+		"Evaluates a buffer of UTC timestamps, shifted by offset seconds, and\n"
+		"returns one boolean per timestamp, written into out when given."},
+	{"dump", (PyCFunction)schedule_dump, METH_NOARGS,
+		"dump() -> str\n\nDebug dump of the compiled rules."},
+	{NULL, NULL, 0, NULL}
+};
+
+static PyTypeObject ScheduleType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "opening_hours.Schedule",
+	.tp_doc = "Schedule(value)\n\nCompiled opening_hours value.",
+	.tp_basicsize = sizeof(Schedule),
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_new = PyType_GenericNew,
+	.tp_init = (initproc)schedule_init,
+	.tp_dealloc = (destructor)schedule_dealloc,
+	.tp_str = (reprfunc)schedule_str,
+	.tp_repr = (reprfunc)schedule_repr,
+	.tp_methods = schedule_methods,
+};
+
+static PyObject *module_build(PyObject *Py_UNUSED(module), PyObject *value) {
+	return (PyObject_CallFunctionObjArgs((PyObject *)&ScheduleType, value, NULL));
 }
 
-#include "compile.h"
-#include "frameobject.h"
-#include "traceback.h"
-
-static void __Pyx_AddTraceback(char *funcname) {
-    PyObject *py_srcfile = 0;
-    PyObject *py_funcname = 0;
-    PyObject *py_globals = 0;
-    PyObject *empty_tuple = 0;
-    PyObject *empty_string = 0;
-    PyCodeObject *py_code = 0;
-    PyFrameObject *py_frame = 0;
-    
-    py_srcfile = PyString_FromString(__pyx_filename);
-    if (!py_srcfile) goto bad;
-    py_funcname = PyString_FromString(funcname);
-    if (!py_funcname) goto bad;
-    py_globals = PyModule_GetDict(__pyx_m);
-    if (!py_globals) goto bad;
-    empty_tuple = PyTuple_New(0);
-    if (!empty_tuple) goto bad;
-    empty_string = PyString_FromString("");
-    if (!empty_string) goto bad;
-    py_code = PyCode_New(
-        0,            /*int argcount,*/
-        0,            /*int nlocals,*/
-        0,            /*int stacksize,*/
-        0,            /*int flags,*/
-        empty_string, /*PyObject *code,*/
-        empty_tuple,  /*PyObject *consts,*/
-        empty_tuple,  /*PyObject *names,*/
-        empty_tuple,  /*PyObject *varnames,*/
-        empty_tuple,  /*PyObject *freevars,*/
-        empty_tuple,  /*PyObject *cellvars,*/
-        py_srcfile,   /*PyObject *filename,*/
-        py_funcname,  /*PyObject *name,*/
-        __pyx_lineno,   /*int firstlineno,*/
-        empty_string  /*PyObject *lnotab*/
-    );
-    if (!py_code) goto bad;
-    py_frame = PyFrame_New(
-        PyThreadState_Get(), /*PyThreadState *tstate,*/
-        py_code,             /*PyCodeObject *code,*/
-        py_globals,          /*PyObject *globals,*/
-        0                    /*PyObject *locals*/
-    );
-    if (!py_frame) goto bad;
-    py_frame->f_lineno = __pyx_lineno;
-    PyTraceBack_Here(py_frame);
-bad:
-    Py_XDECREF(py_srcfile);
-    Py_XDECREF(py_funcname);
-    Py_XDECREF(empty_tuple);
-    Py_XDECREF(empty_string);
-    Py_XDECREF(py_code);
-    Py_XDECREF(py_frame);
+static PyMethodDef module_methods[] = {
+	{"build", module_build, METH_O, "build(value) -> Schedule"},
+	{NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef module = {
+	PyModuleDef_HEAD_INIT,
+	.m_name = "opening_hours",
+	.m_doc = "OpenStreetMap opening_hours parsing and evaluation.",
+	.m_size = -1,
+	.m_methods = module_methods,
+};
+
+PyMODINIT_FUNC PyInit_opening_hours(void) {
+	PyObject *m;
+
+	if (PyType_Ready(&ScheduleType) < 0)
+		return (NULL);
+	if (!(m = PyModule_Create(&module)))
+		return (NULL);
+	Py_INCREF(&ScheduleType);
+	if (PyModule_AddObject(m, "Schedule", (PyObject *)&ScheduleType) < 0) {
+		Py_DECREF(&ScheduleType);
+		Py_DECREF(m);
+		return (NULL);
+	}
+	return (m);
 }
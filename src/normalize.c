@@ -0,0 +1,441 @@
+#include <stdio.h>
+#include <string.h>
+#include "normalize.h"
+#include "parsing.h"
+
+bool valid_monthday(size_t index) {
+	return (index < NB_MONTHDAYS && (int)(index % 32) < NB_DAYS[index / 32]);
+}
+
+/* Rules matching every date, as is_open() sees them. */
+static bool matches_any_date(rule_sequence *rule) {
+	return (rule->selector.anyway || rule->selector.wide_range.type == WIDE_RANGE_COMMENT);
+}
+
+/* Years out of the [1900, 2923] range are only matched by rules leaving years unconstrained, as in is_open(). */
+static bool rule_has_year(rule_sequence *rule, long year) {
+	bitset years = rule->selector.wide_range.years;
+
+	return (matches_any_date(rule) || !years
+			|| (year >= 0 && year < NB_YEARS ? GET_BIT(years, year) : years == shared_years));
+}
+
+static bool rule_has_monthday(rule_sequence *rule, long monthday) {
+	return (matches_any_date(rule) || !rule->selector.wide_range.monthdays.days
+			|| (monthday >= 0 && monthday < NB_MONTHDAYS && GET_BIT(rule->selector.wide_range.monthdays.days, monthday)));
+}
+
+/*
+ * Minutes of a day of the week (Mo = 0) a rule matches, for the dates it
+ * selects. Variable times are those of monthday at location, or left out
+ * when location is NULL.
+ */
+static void rule_day(rule_sequence *rule, const solar_location *location, int monthday, size_t day, _word_t *slice) {
+	small_range_selector *small = &rule->selector.small_range;
+	size_t i;
+
+	if (rule->selector.anyway || !small->weekday.range) {
+		_bitset_ops->fill_words(slice, ~ (_word_t) 0, DAY_NWORDS);
+	} else {
+		_bitset_ops->fill_words(slice, 0, DAY_NWORDS);
+		if (GET_BIT(small->weekday.range, day) && small->hours.time_range)
+			for (i = 0; i < DAY_NWORDS; i++)
+				slice[i] |= small->hours.time_range[i];
+		if (GET_BIT(small->weekday.range, (day + 6) % 7) && small->hours.extended_time_range)
+			for (i = 0; i < DAY_NWORDS; i++)
+				slice[i] |= small->hours.extended_time_range[i];
+		if (location && small->hours.variable)
+			variable_hours_day(location, &small->hours, monthday, GET_BIT(small->weekday.range, day),
+					GET_BIT(small->weekday.range, (day + 6) % 7), slice);
+	}
+	slice[DAY_NWORDS - 1] &= _LAST_WORD_MASK(DAY_MINUTES);
+}
+
+/* rule_day() of the 7 days of the week, one after the other, variable times left out. */
+void rule_week(rule_sequence *rule, _word_t *week) {
+	for (size_t day = 0; day < 7; day++)
+		rule_day(rule, NULL, 0, day, week + day * DAY_NWORDS);
+}
+
+static bool has_variable_times(rule_sequence *rule) {
+	return (!rule->selector.anyway && rule->selector.small_range.hours.variable);
+}
+
+static bool same_week(rule_sequence *a, rule_sequence *b) {
+	return (!has_variable_times(a) && !has_variable_times(b)
+			&& a->selector.anyway == b->selector.anyway
+			&& a->selector.small_range.weekday.range == b->selector.small_range.weekday.range
+			&& a->selector.small_range.hours.time_range == b->selector.small_range.hours.time_range
+			&& a->selector.small_range.hours.extended_time_range == b->selector.small_range.hours.extended_time_range);
+}
+
+/*
+ * Open minutes of a single day, as is_open() sees them: tm_year and
+ * monthday (month * 32 + day - 1) select the rules, weekday (Mo = 0) the
+ * minutes.
+ */
+void day_profile(opening_hours oh, int tm_year, int monthday, int weekday, _word_t *day) {
+	_word_t covered[DAY_NWORDS] = {0},
+		rule[DAY_NWORDS];
+	solar_location *location = &oh->location;
+	size_t i;
+
+	_bitset_ops->fill_words(day, 0, DAY_NWORDS);
+	for (; oh; oh = oh->next_item) {
+		if (!rule_has_year(&oh->rule, tm_year) || !rule_has_monthday(&oh->rule, monthday))
+			continue;
+		rule_day(&oh->rule, location, monthday, weekday, rule);
+		if (oh->rule.state.type == RULE_OPEN)
+			for (i = 0; i < DAY_NWORDS; i++)
+				day[i] |= rule[i] & ~covered[i];
+		_bitset_ops->or_words(covered, covered, rule, DAY_NWORDS);
+	}
+}
+
+/*
+ * First monthday index after monthday where the set of rules selecting the
+ * date, or the times of the ones with variable times, change in year
+ * tm_year; NB_MONTHDAYS if they don't until the end of the year. Indexes of
+ * days a month doesn't have may be returned. Each rule's days are scanned
+ * a word at a time, and only up to the earliest change found so far.
+ */
+int next_selection_change(opening_hours oh, int tm_year, int monthday) {
+	size_t change = NB_MONTHDAYS;
+	bitset days;
+
+	for (; oh; oh = oh->next_item) {
+		if (has_variable_times(&oh->rule) && rule_has_year(&oh->rule, tm_year))
+			return (monthday + 1);
+		if (matches_any_date(&oh->rule) || !rule_has_year(&oh->rule, tm_year)
+				|| !(days = oh->rule.selector.wide_range.monthdays.days))
+			continue;
+		change = _bitset_scan(days, monthday + 1, _MIN(change, BITSET_SIZE(days)),
+				GET_BIT(days, monthday) ? ~ (_word_t) 0 : 0);
+	}
+	return (change);
+}
+
+/*
+ * Gives each of the n members the id of the first earlier member with
+ * the same nwords long signature, or a new id. Returns the number of ids.
+ */
+static size_t group_signatures(_word_t *signatures, size_t nwords, size_t n, unsigned short *ids, size_t *first) {
+	size_t nb_ids = 0, i, j;
+
+	for (i = 0; i < n; i++) {
+		if (ids[i] == NO_CLASS)
+			continue;
+		for (j = 0; j < nb_ids; j++)
+			if (_bitset_ops->equal_words(signatures + i * nwords, signatures + first[j] * nwords, nwords))
+				break;
+		if (j == nb_ids)
+			first[nb_ids++] = i;
+		ids[i] = j;
+	}
+	return (nb_ids);
+}
+
+/*
+ * Turns a table of week profiles over year and monthday atoms into the
+ * normalized form: atoms behaving the same are merged. Atoms must be
+ * numbered in the order of their first member, which gives classes in
+ * that same order.
+ */
+static normalized_oh *canonicalize(size_t nb_year_atoms, unsigned short *year_atom,
+		size_t nb_monthday_atoms, unsigned short *monthday_atom, _word_t *weeks) {
+	normalized_oh *n = calloc_or_die(NULL, 1, sizeof(*n), "normalized oh");
+	size_t row = nb_monthday_atoms * WEEK_NWORDS,
+	       *year_rep = calloc_or_die(NULL, nb_year_atoms, sizeof(size_t), "normalized oh"),
+	       *monthday_rep = calloc_or_die(NULL, nb_monthday_atoms, sizeof(size_t), "normalized oh");
+	unsigned short *year_map = calloc_or_die(NULL, nb_year_atoms, sizeof(unsigned short), "normalized oh"),
+		       *monthday_map = calloc_or_die(NULL, nb_monthday_atoms, sizeof(unsigned short), "normalized oh");
+	_word_t *columns;
+	size_t y, m, i;
+
+	n->nb_years = group_signatures(weeks, row, nb_year_atoms, year_map, year_rep);
+
+	/* Monthday atoms compare by their profiles over the year classes. */
+	columns = calloc_or_die(NULL, nb_monthday_atoms * n->nb_years * WEEK_NWORDS, sizeof(_word_t), "normalized oh");
+	for (m = 0; m < nb_monthday_atoms; m++)
+		for (y = 0; y < n->nb_years; y++)
+			memcpy(columns + (m * n->nb_years + y) * WEEK_NWORDS, weeks + year_rep[y] * row + m * WEEK_NWORDS,
+					WEEK_NWORDS * sizeof(_word_t));
+	n->nb_monthdays = group_signatures(columns, n->nb_years * WEEK_NWORDS, nb_monthday_atoms, monthday_map, monthday_rep);
+	_oh_free(columns);
+
+	n->years = calloc_or_die(NULL, n->nb_years, sizeof(bitset), "normalized oh");
+	for (y = 0; y < n->nb_years; y++)
+		n->years[y] = Bitset(NB_YEARS);
+	n->monthdays = calloc_or_die(NULL, n->nb_monthdays, sizeof(bitset), "normalized oh");
+	for (m = 0; m < n->nb_monthdays; m++)
+		n->monthdays[m] = Bitset(NB_MONTHDAYS);
+	for (i = 0; i < NB_YEARS; i++) {
+		n->year_class[i] = year_map[year_atom[i]];
+		SET_BIT(n->years[n->year_class[i]], i, true);
+	}
+	for (i = 0; i < NB_MONTHDAYS; i++) {
+		if ((n->monthday_class[i] = monthday_atom[i]) == NO_CLASS)
+			continue;
+		n->monthday_class[i] = monthday_map[monthday_atom[i]];
+		SET_BIT(n->monthdays[n->monthday_class[i]], i, true);
+	}
+
+	n->weeks = calloc_or_die(NULL, n->nb_years * n->nb_monthdays * WEEK_NWORDS, sizeof(_word_t), "normalized oh");
+	for (y = 0; y < n->nb_years; y++)
+		for (m = 0; m < n->nb_monthdays; m++)
+			memcpy(NORMALIZED_WEEK(n, y, m), weeks + year_rep[y] * row + monthday_rep[m] * WEEK_NWORDS,
+					WEEK_NWORDS * sizeof(_word_t));
+
+	_oh_free(year_rep);
+	_oh_free(monthday_rep);
+	_oh_free(year_map);
+	_oh_free(monthday_map);
+	return (n);
+}
+
+normalized_oh *normalize_oh(opening_hours oh) {
+	opening_hours cur;
+	rule_sequence **rules;
+	size_t nb_rules = 0, nwords, nb_year_atoms, nb_monthday_atoms, r, i, y, m;
+	size_t *year_first, *monthday_first;
+	unsigned short year_atom[NB_YEARS] = {0},
+		       monthday_atom[NB_MONTHDAYS];
+	_word_t *year_sigs, *monthday_sigs, *rule_weeks, *weeks, *applies,
+		covered[WEEK_NWORDS], variable_week[WEEK_NWORDS], *week, *rule_row;
+	bool variable = false;
+	normalized_oh *n;
+
+	if (!oh)
+		return (NULL);
+	for (cur = oh; cur; cur = cur->next_item)
+		++nb_rules;
+	rules = calloc_or_die(NULL, nb_rules, sizeof(*rules), "normalized oh");
+	for (cur = oh, r = 0; cur; cur = cur->next_item) {
+		variable |= has_variable_times(&cur->rule);
+		rules[r++] = &cur->rule;
+	}
+
+	/* Years (and monthdays) are first gathered by the set of rules selecting them. */
+	nwords = _B_NWORDS(nb_rules);
+	year_sigs = calloc_or_die(NULL, NB_YEARS * nwords, sizeof(_word_t), "normalized oh");
+	monthday_sigs = calloc_or_die(NULL, NB_MONTHDAYS * nwords, sizeof(_word_t), "normalized oh");
+	for (i = 0; i < NB_MONTHDAYS; i++)
+		monthday_atom[i] = valid_monthday(i) ? 0 : NO_CLASS;
+	for (r = 0; r < nb_rules; r++) {
+		for (i = 0; i < NB_YEARS; i++)
+			if (rule_has_year(rules[r], i))
+				SET_BIT(year_sigs + i * nwords, r, true);
+		for (i = 0; i < NB_MONTHDAYS; i++)
+			if (monthday_atom[i] != NO_CLASS && rule_has_monthday(rules[r], i))
+				SET_BIT(monthday_sigs + i * nwords, r, true);
+	}
+	year_first = calloc_or_die(NULL, NB_YEARS, sizeof(size_t), "normalized oh");
+	monthday_first = calloc_or_die(NULL, NB_MONTHDAYS, sizeof(size_t), "normalized oh");
+	nb_year_atoms = group_signatures(year_sigs, nwords, NB_YEARS, year_atom, year_first);
+	nb_monthday_atoms = group_signatures(monthday_sigs, nwords, NB_MONTHDAYS, monthday_atom, monthday_first);
+	/* Variable times change from a day to the next: each monthday is then an atom of its own. */
+	if (variable)
+		for (i = 0, nb_monthday_atoms = 0; i < NB_MONTHDAYS; i++)
+			if (monthday_atom[i] != NO_CLASS)
+				monthday_first[nb_monthday_atoms] = i, monthday_atom[i] = nb_monthday_atoms++;
+
+	/* Pooled selectors are equal if and only if they are the same: rules sharing theirs share their week. */
+	rule_weeks = calloc_or_die(NULL, nb_rules * WEEK_NWORDS, sizeof(_word_t), "normalized oh");
+	for (r = 0; r < nb_rules; r++) {
+		for (i = 0; i < r && !same_week(rules[i], rules[r]); i++);
+		if (i < r)
+			memcpy(rule_weeks + r * WEEK_NWORDS, rule_weeks + i * WEEK_NWORDS, WEEK_NWORDS * sizeof(_word_t));
+		else
+			rule_week(rules[r], rule_weeks + r * WEEK_NWORDS);
+	}
+
+	/* First matching rule wins, as in is_open(). */
+	weeks = calloc_or_die(NULL, nb_year_atoms * nb_monthday_atoms * WEEK_NWORDS, sizeof(_word_t), "normalized oh");
+	applies = calloc_or_die(NULL, nwords, sizeof(_word_t), "normalized oh");
+	for (y = 0; y < nb_year_atoms; y++) {
+		for (m = 0; m < nb_monthday_atoms; m++) {
+			week = weeks + (y * nb_monthday_atoms + m) * WEEK_NWORDS;
+			memset(covered, 0, sizeof(covered));
+			for (i = 0; i < nwords; i++)
+				applies[i] = year_sigs[year_first[y] * nwords + i] & monthday_sigs[monthday_first[m] * nwords + i];
+			for (r = 0; r < nb_rules; r++) {
+				if (!GET_BIT(applies, r))
+					continue;
+				rule_row = rule_weeks + r * WEEK_NWORDS;
+				if (has_variable_times(rules[r])) {
+					for (i = 0; i < 7; i++)
+						rule_day(rules[r], &oh->location, monthday_first[m], i, variable_week + i * DAY_NWORDS);
+					rule_row = variable_week;
+				}
+				for (i = 0; i < WEEK_NWORDS; i++) {
+					if (rules[r]->state.type == RULE_OPEN)
+						week[i] |= rule_row[i] & ~covered[i];
+					covered[i] |= rule_row[i];
+				}
+			}
+		}
+	}
+	n = canonicalize(nb_year_atoms, year_atom, nb_monthday_atoms, monthday_atom, weeks);
+
+	_oh_free(applies);
+	_oh_free(weeks);
+	_oh_free(rule_weeks);
+	_oh_free(year_first);
+	_oh_free(monthday_first);
+	_oh_free(year_sigs);
+	_oh_free(monthday_sigs);
+	_oh_free(rules);
+	return (n);
+}
+
+/*
+ * Pairs of classes (one of a, one of b) met by the members, numbered in
+ * the order of their first member. first_a and first_b receive the
+ * classes of each pair.
+ */
+static size_t pair_classes(unsigned short *a, size_t nb_a, unsigned short *b, size_t nb_b, size_t n,
+		unsigned short *atoms, unsigned short *first_a, unsigned short *first_b) {
+	unsigned short *pairs = calloc_or_die(NULL, nb_a * nb_b, sizeof(unsigned short), "normalized oh");
+	size_t nb_atoms = 0, i;
+
+	memset(pairs, 0xff, nb_a * nb_b * sizeof(unsigned short));
+	for (i = 0; i < n; i++) {
+		if (a[i] == NO_CLASS) {
+			atoms[i] = NO_CLASS;
+			continue;
+		}
+		if (pairs[a[i] * nb_b + b[i]] == NO_CLASS) {
+			first_a[nb_atoms] = a[i];
+			first_b[nb_atoms] = b[i];
+			pairs[a[i] * nb_b + b[i]] = nb_atoms++;
+		}
+		atoms[i] = pairs[a[i] * nb_b + b[i]];
+	}
+	_oh_free(pairs);
+	return (nb_atoms);
+}
+
+normalized_oh *combine_normalized(normalized_oh *a, normalized_oh *b, normalized_op op) {
+	unsigned short year_atom[NB_YEARS], monthday_atom[NB_MONTHDAYS],
+		       year_a[NB_YEARS], year_b[NB_YEARS], monthday_a[NB_MONTHDAYS], monthday_b[NB_MONTHDAYS];
+	size_t nb_year_atoms, nb_monthday_atoms, y, m;
+	_word_t *weeks, *week, *wa, *wb;
+	normalized_oh *n;
+
+	if (!a || !b)
+		return (NULL);
+	nb_year_atoms = pair_classes(a->year_class, a->nb_years, b->year_class, b->nb_years, NB_YEARS,
+			year_atom, year_a, year_b);
+	nb_monthday_atoms = pair_classes(a->monthday_class, a->nb_monthdays, b->monthday_class, b->nb_monthdays,
+			NB_MONTHDAYS, monthday_atom, monthday_a, monthday_b);
+
+	weeks = calloc_or_die(NULL, nb_year_atoms * nb_monthday_atoms * WEEK_NWORDS, sizeof(_word_t), "normalized oh");
+	for (y = 0; y < nb_year_atoms; y++) {
+		for (m = 0; m < nb_monthday_atoms; m++) {
+			week = weeks + (y * nb_monthday_atoms + m) * WEEK_NWORDS;
+			wa = NORMALIZED_WEEK(a, year_a[y], monthday_a[m]);
+			wb = NORMALIZED_WEEK(b, year_b[y], monthday_b[m]);
+			switch (op) {
+				case NORMALIZED_AND:    _bitset_ops->and_words(week, wa, wb, WEEK_NWORDS); break;
+				case NORMALIZED_OR:     _bitset_ops->or_words(week, wa, wb, WEEK_NWORDS); break;
+				case NORMALIZED_ANDNOT: _bitset_ops->andnot_words(week, wa, wb, WEEK_NWORDS); break;
+				case NORMALIZED_XOR:    _bitset_ops->xor_words(week, wa, wb, WEEK_NWORDS); break;
+			}
+		}
+	}
+	n = canonicalize(nb_year_atoms, year_atom, nb_monthday_atoms, monthday_atom, weeks);
+	_oh_free(weeks);
+	return (n);
+}
+
+static opening_hours new_rule(opening_hours *head, opening_hours *tail, bitset years, bitset monthdays) {
+	opening_hours rule = calloc_or_die(NULL, 1, sizeof(*rule), "normalized oh");
+	wide_range_selector *wide = &rule->rule.selector.wide_range;
+	small_range_selector *small = &rule->rule.selector.small_range;
+
+	rule->rule.separator = *head ? SEP_COMA : SEP_HEAD;
+	wide->type = WIDE_RANGE_DATE;
+	wide->years = copy_bitset(years);
+	wide->monthdays.days = copy_bitset(monthdays);
+	wide->weeks = shared_weeks;
+	small->weekday.type = WD_RANGE;
+	small->weekday.range = Bitset(7);
+	small->hours.time_range = Bitset(DAY_MINUTES);
+	small->hours.extended_time_range = shared_no_minutes;
+	if (*tail)
+		(*tail)->next_item = rule;
+	else
+		*head = rule;
+	*tail = rule;
+	return (rule);
+}
+
+static bool empty_day(_word_t *slice) {
+	size_t i;
+
+	for (i = 0; i < DAY_NWORDS; i++)
+		if (slice[i])
+			return (false);
+	return (true);
+}
+
+/*
+ * Rebuilds rules from a normalized form: one open rule for each group of
+ * weekdays sharing the same hours, in each (year class, monthday class)
+ * pair. Rules never overlap, so their order doesn't matter.
+ * A form open at no time gives a single closed rule.
+ */
+opening_hours normalized_to_oh(normalized_oh *n) {
+	opening_hours head = NULL, tail = NULL, rule;
+	bool done[7];
+	_word_t *week;
+	size_t y, m, d, other;
+
+	if (!n)
+		return (NULL);
+	for (y = 0; y < n->nb_years; y++) {
+		for (m = 0; m < n->nb_monthdays; m++) {
+			week = NORMALIZED_WEEK(n, y, m);
+			memset(done, 0, sizeof(done));
+			for (d = 0; d < 7; d++) {
+				if (done[d] || empty_day(week + d * DAY_NWORDS))
+					continue;
+				rule = new_rule(&head, &tail, n->years[y], n->monthdays[m]);
+				rule->rule.state.type = RULE_OPEN;
+				memcpy(rule->rule.selector.small_range.hours.time_range, week + d * DAY_NWORDS,
+						DAY_NWORDS * sizeof(_word_t));
+				for (other = d; other < 7; other++) {
+					if (_bitset_ops->equal_words(week + d * DAY_NWORDS, week + other * DAY_NWORDS, DAY_NWORDS)) {
+						SET_BIT(rule->rule.selector.small_range.weekday.range, other, true);
+						done[other] = true;
+					}
+				}
+			}
+		}
+	}
+	if (!head) {
+		rule = new_rule(&head, &tail, shared_years, shared_monthdays);
+		rule->rule.state.type = RULE_CLOSED;
+		set_subset(rule->rule.selector.small_range.weekday.range, 0, 6, true);
+		set_subset(rule->rule.selector.small_range.hours.time_range, 0, DAY_MINUTES - 1, true);
+	}
+	for (rule = head; rule; rule = rule->next_item)
+		intern_rule(&rule->rule);
+	bind_evaluator(head);
+	return (head);
+}
+
+void free_normalized(normalized_oh *n) {
+	size_t i;
+
+	if (!n)
+		return;
+	for (i = 0; i < n->nb_years; i++)
+		del_bitset(n->years[i]);
+	for (i = 0; i < n->nb_monthdays; i++)
+		del_bitset(n->monthdays[i]);
+	_oh_free(n->years);
+	_oh_free(n->monthdays);
+	_oh_free(n->weeks);
+	_oh_free(n);
+}
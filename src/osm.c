@@ -0,0 +1,305 @@
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "opening_hours.h"
+#include "allocator.h"
+
+/*
+ * Loading of the schedules tagged in an OSM XML file into a store.
+ *
+ * The file is mapped rather than read, and worker threads take chunks of
+ * it in turn, so memory stays bounded by the store whatever the size of
+ * the extract. In its chunk, a worker looks for tag keys (k="...") only:
+ * the element a matching tag belongs to is found by looking back from it,
+ * and nothing else of the XML is parsed. An element keeps one schedule:
+ * the tag which finds another one in its element to keep instead counts as a
+ * duplicate, so that the result doesn't depend on which worker stores first.
+ */
+
+#define CHUNK_BYTES    (1 << 20)
+#define VALUE_SIZE     1024
+#define DEFAULT_KEY    "opening_hours"
+
+#define IS_SPACE(c)    ((c) == ' ' || (c) == '\t' || (c) == '\n' || (c) == '\r')
+#define IS_QUOTE(c)    ((c) == '"' || (c) == '\'')
+
+typedef struct osm_reader osm_reader;
+
+struct osm_reader {
+	const char *map;
+	const char *end;
+	const char *key;
+	size_t key_len;
+	bool prefix;           /* the key ended with '*' */
+	bool subkeys;          /* the key also matches its subkeys, key:... */
+	oh_store *store;
+	const oh_allocator *allocator;
+	size_t next;           /* offset of the first chunk not taken by a worker yet */
+	long stored;
+	size_t invalid;
+	size_t duplicates;
+};
+
+/*
+ * If s starts with a key matched by r and its closing quote, returns the
+ * character after it, with *exact set if it is the key itself; NULL
+ * otherwise.
+ */
+static const char *match_key(osm_reader *r, const char *s, char quote, bool *exact) {
+	if ((size_t) (r->end - s) <= r->key_len || memcmp(s, r->key, r->key_len))
+		return (NULL);
+	s += r->key_len;
+	*exact = *s == quote;
+	if (r->prefix || (r->subkeys && *s == ':'))
+		while (s < r->end && *s != quote)
+			++s;
+	return (s < r->end && *s == quote ? s + 1 : NULL);
+}
+
+/* Start and length of the value following a key, or NULL. */
+static const char *find_value(osm_reader *r, const char *s, size_t *len) {
+	const char *value_end;
+	char quote;
+
+	while (s < r->end && IS_SPACE(*s))
+		++s;
+	if (r->end - s < 3 || s[0] != 'v' || s[1] != '=' || !IS_QUOTE(s[2]))
+		return (NULL);
+	quote = s[2];
+	s += 3;
+	if (!(value_end = memchr(s, quote, r->end - s)))
+		return (NULL);
+	*len = value_end - s;
+	return (s);
+}
+
+/*
+ * Id of the element a tag belongs to, with its type in the high bits, and
+ * its start, looking back from the tag. Returns false if the tag is not
+ * inside a node, way or relation.
+ */
+static bool find_element(osm_reader *r, const char *tag, const char **element, unsigned long long *id) {
+	const char *s = tag, *end;
+	unsigned long long type, value = 0;
+	bool negative = false;
+
+	for (;;) {
+		while (s > r->map && *--s != '<');
+		if (*s != '<' || s[1] == '/')
+			return (false);
+		if (!strncmp(s + 1, "node", 4) && IS_SPACE(s[5]))
+			type = 0;
+		else if (!strncmp(s + 1, "way", 3) && IS_SPACE(s[4]))
+			type = OH_OSM_WAY;
+		else if (!strncmp(s + 1, "relation", 8) && IS_SPACE(s[9]))
+			type = OH_OSM_RELATION;
+		else if (s == r->map)
+			return (false);
+		else
+			continue;
+		break;
+	}
+	if (!(end = memchr(s, '>', r->end - s)) || end[-1] == '/')
+		return (false);
+	*element = s;
+	for (; s + 4 < end; s++)
+		if (IS_SPACE(s[0]) && s[1] == 'i' && s[2] == 'd' && s[3] == '=' && IS_QUOTE(s[4]))
+			break;
+	if ((s += 5) >= end)
+		return (false);
+	if ((negative = *s == '-'))
+		++s;
+	for (; s < end && *s >= '0' && *s <= '9'; s++)
+		value = value * 10 + *s - '0';
+	*id = ((negative ? -value : value) & ~OH_OSM_RELATION & ~OH_OSM_WAY) | type;
+	return (s < end && IS_QUOTE(*s));
+}
+
+/* Copies a value into buffer, decoding XML entities. Returns its length, or -1 if it does not fit. */
+static long decode_value(const char *s, size_t len, char *buffer) {
+	static const struct { const char *name; char c; } entities[] = {
+		{"&quot;", '"'}, {"&apos;", '\''}, {"&amp;", '&'}, {"&lt;", '<'}, {"&gt;", '>'}
+	};
+	const char *end = s + len;
+	size_t i, name_len, n = 0;
+	char *number_end;
+	long code;
+
+	if (len >= VALUE_SIZE)
+		return (-1);
+	while (s < end) {
+		if (*s != '&') {
+			buffer[n++] = *s++;
+			continue;
+		}
+		for (i = 0; i < sizeof(entities) / sizeof(*entities); i++)
+			if ((size_t) (end - s) >= (name_len = strlen(entities[i].name)) && !strncmp(s, entities[i].name, name_len))
+				break;
+		if (i < sizeof(entities) / sizeof(*entities)) {
+			buffer[n++] = entities[i].c;
+			s += name_len;
+		/* Schedules are ASCII: other characters are left encoded, for the parser to reject. */
+		} else if (end - s > 2 && s[1] == '#'
+				&& (code = s[2] == 'x' ? strtol(s + 3, &number_end, 16) : strtol(s + 2, &number_end, 10)) > 0
+				&& code < 0x80 && number_end < end && *number_end == ';') {
+			buffer[n++] = (char) code;
+			s = number_end + 1;
+		} else {
+			buffer[n++] = *s++;
+		}
+	}
+	buffer[n] = '\0';
+	return ((long) n);
+}
+
+/* Value of a tag decoded into buffer if it is a valid schedule. Returns its length, or -1. */
+static long valid_value(const char *value, size_t len, char *buffer) {
+	long n = decode_value(value, len, buffer);
+
+	return (n >= 0 && oh_validate(buffer, n, NULL) ? n : -1);
+}
+
+/* Start of a tag key (k="...") at s, whose quote is then s[2]. */
+static bool is_key(osm_reader *r, const char *s) {
+	return (s > r->map && IS_SPACE(s[-1]) && r->end - s >= 3 && s[0] == 'k' && s[1] == '=' && IS_QUOTE(s[2]));
+}
+
+/*
+ * Whether the element starting at element keeps the valid tag at tag: it
+ * keeps its first valid tag with exactly the key of r, or else its first
+ * valid matching tag.
+ */
+static bool kept_tag(osm_reader *r, const char *element, const char *tag, bool exact) {
+	const char *s, *end, *value;
+	char buffer[VALUE_SIZE];
+	bool other_exact;
+	size_t len;
+
+	/* The element ends at its closing tag. */
+	for (end = element + 1; (end = memchr(end, '<', r->end - end)) && end + 1 < r->end && end[1] != '/'; end++);
+	if (!end)
+		end = r->end;
+	for (s = element; (s = memchr(s, 'k', end - s)); s++) {
+		if (s == tag || !is_key(r, s) || !(value = match_key(r, s + 3, s[2], &other_exact))
+				|| !(value = find_value(r, value, &len)))
+			continue;
+		if ((other_exact > exact || (other_exact == exact && s < tag)) && valid_value(value, len, buffer) >= 0)
+			return (false);
+	}
+	return (true);
+}
+
+static void load_tag(osm_reader *r, const char *tag, bool exact, const char *value, size_t len,
+		long *stored, size_t *invalid, size_t *duplicates) {
+	unsigned long long id;
+	const char *element;
+	char buffer[VALUE_SIZE];
+
+	if (!find_element(r, tag, &element, &id))
+		return;
+	if (valid_value(value, len, buffer) < 0) {
+		++*invalid;
+		return;
+	}
+	if (!kept_tag(r, element, tag, exact)) {
+		++*duplicates;
+		return;
+	}
+	if (oh_store_put(r->store, id, build_opening_hours(buffer)) >= 0)
+		++*stored;
+}
+
+static void *worker(void *arg) {
+	osm_reader *r = arg;
+	const char *s, *chunk_end, *after_key, *value;
+	size_t first, len, invalid = 0, duplicates = 0;
+	long stored = 0;
+	bool exact;
+
+	while ((first = __atomic_fetch_add(&r->next, CHUNK_BYTES, __ATOMIC_RELAXED)) < (size_t) (r->end - r->map)) {
+		chunk_end = r->map + _MIN(first + CHUNK_BYTES, (size_t) (r->end - r->map));
+		/* Keys starting in the chunk are the worker's, even if they end after it. */
+		for (s = r->map + first; (s = memchr(s, 'k', chunk_end - s)); s++) {
+			if (!is_key(r, s))
+				continue;
+			if ((after_key = match_key(r, s + 3, s[2], &exact)) && (value = find_value(r, after_key, &len)))
+				load_tag(r, s, exact, value, len, &stored, &invalid, &duplicates);
+		}
+	}
+	__atomic_add_fetch(&r->stored, stored, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&r->invalid, invalid, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&r->duplicates, duplicates, __ATOMIC_RELAXED);
+	return (NULL);
+}
+
+/* Workers allocate as the thread which started them. */
+static void *thread_worker(void *arg) {
+	oh_set_thread_allocator(((osm_reader *) arg)->allocator);
+	return (worker(arg));
+}
+
+/*
+ * Stores the schedule of every element of the OSM XML file at path tagged
+ * with key, under the id of the element, with OH_OSM_WAY or OH_OSM_RELATION
+ * for ways and relations. A key ending with '*', such as "opening_hours:*",
+ * matches every key it starts; NULL matches "opening_hours" and its
+ * subkeys "opening_hours:*". An element with several valid matching tags
+ * keeps its first one with exactly the key (without the '*'), or else its
+ * first one; the others are counted in *duplicates when it is not NULL.
+ * Invalid values are skipped silently, and counted in *invalid when it is
+ * not NULL. Uses nb_threads threads, or one per CPU if it is not positive.
+ * Returns the number of schedules stored, or -1 if the file can't be read.
+ */
+long oh_store_load_osm(oh_store *store, const char *path, const char *key, int nb_threads, size_t *invalid,
+		size_t *duplicates) {
+	osm_reader r = {0};
+	pthread_t *threads;
+	struct stat st;
+	int fd, i, started = 0;
+	void *map = NULL;
+
+	if (!store || !path || (fd = open(path, O_RDONLY)) < 0)
+		return (-1);
+	if (fstat(fd, &st) < 0 || (st.st_size && (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)) {
+		close(fd);
+		return (-1);
+	}
+	close(fd);
+	if (invalid)
+		*invalid = 0;
+	if (duplicates)
+		*duplicates = 0;
+	if (!st.st_size)
+		return (0);
+	posix_madvise(map, st.st_size, POSIX_MADV_SEQUENTIAL);
+	r.map = map;
+	r.end = r.map + st.st_size;
+	r.key = key ? key : DEFAULT_KEY;
+	r.subkeys = !key;
+	r.key_len = strlen(r.key);
+	if ((r.prefix = r.key_len && r.key[r.key_len - 1] == '*'))
+		--r.key_len;
+	r.store = store;
+	r.allocator = oh_current_allocator();
+	if (nb_threads <= 0)
+		nb_threads = _MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+	nb_threads = _MIN((size_t) nb_threads, (size_t) st.st_size / CHUNK_BYTES + 1);
+	if ((threads = _oh_malloc(nb_threads * sizeof(*threads))))
+		for (i = 1; i < nb_threads; i++)
+			if (!pthread_create(&threads[started], NULL, thread_worker, &r))
+				++started;
+	worker(&r);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	_oh_free(threads);
+	munmap(map, st.st_size);
+	if (invalid)
+		*invalid = r.invalid;
+	if (duplicates)
+		*duplicates = r.duplicates;
+	return (r.stored);
+}
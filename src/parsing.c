@@ -1,18 +1,111 @@
 #include <ctype.h>
+#include <pthread.h>
+#include <stdarg.h>
 #include <string.h>
 #include "parsing.h"
 
-int match(char *s, char *pattern) {
-	regex_t reg;
-	regmatch_t matched;
+__thread oh_error *validating = NULL;
+
+#define ONES (~ (_word_t) 0)
+
+/*
+ * Selectors left unconstrained by a rule, shared by all of them: bitsets
+ * in read-only memory, each preceded by its number of bits.
+ */
+static const _word_t shared_words[] = {
+	1024, ONES, ONES, ONES, ONES, ONES, ONES, ONES, ONES,                    /* every year       */
+	12 * 32, ONES, ONES, ONES,                                              /* every monthday   */
+	54, ((_word_t) 1 << 53) - 1,                                            /* weeks 1 to 53    */
+	7, 0x7f,                                                                /* every weekday    */
+	24 * 60, ONES, ONES, ONES, ONES, ONES, ONES, ONES, ONES, ONES, ONES, ONES,
+	((_word_t) 1 << 32) - 1,                                                /* every minute     */
+	24 * 60, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0                             /* no minute        */
+};
+
+bitset const shared_years = (bitset) (shared_words + 1);
+bitset const shared_monthdays = (bitset) (shared_words + 10);
+bitset const shared_weeks = (bitset) (shared_words + 14);
+bitset const shared_weekdays = (bitset) (shared_words + 16);
+bitset const shared_minutes = (bitset) (shared_words + 18);
+bitset const shared_no_minutes = (bitset) (shared_words + 31);
+
+bool is_shared_bitset(bitset set) {
+	return (set > shared_words && set < shared_words + sizeof(shared_words) / sizeof(*shared_words));
+}
+
+/* Prints an error of the grammar, or records it when validating. */
+void parse_error(const char *format, ...) {
+	char message[OH_ERROR_SIZE * 2], *src, *dst, *end;
+	va_list args;
+
+	va_start(args, format);
+	if (!VALIDATING) {
+		vprintf(format, args);
+		va_end(args);
+		return;
+	}
+	vsnprintf(message, sizeof(message), format, args);
+	va_end(args);
+	/* Messages spanning several lines are joined into one. */
+	dst = validating->message;
+	end = dst + OH_ERROR_SIZE - 1;
+	for (src = message; *src && dst < end; src++) {
+		if (*src != '\n')
+			*dst++ = *src;
+		else if (src[1])
+			for (*dst++ = ' '; src[1] == ' '; src++);
+	}
+	*dst = '\0';
+}
+
+#define VALIDATING_REGEXES 8
+
+/*
+ * The grammar's regexes, compiled once for all validations: nothing is
+ * compiled for them then. Returns NULL once the cache is full.
+ */
+static regex_t *validating_regex(char *pattern) {
+	static struct {
+		char *pattern;
+		regex_t reg;
+	} cache[VALIDATING_REGEXES];
+	static size_t nb_cached = 0;
+	static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	regex_t *reg = NULL;
+	size_t i;
+
+	pthread_mutex_lock(&lock);
+	for (i = 0; i < nb_cached && !reg; i++)
+		if (!strcmp(cache[i].pattern, pattern))
+			reg = &cache[i].reg;
+	if (!reg && nb_cached < VALIDATING_REGEXES) {
+		REG_COMPILE(cache[nb_cached].reg, pattern, REG_EXTENDED);
+		cache[nb_cached].pattern = pattern;
+		reg = &cache[nb_cached++].reg;
+	}
+	pthread_mutex_unlock(&lock);
+	return (reg);
+}
+
+/* Looks for pattern in s, filling matched with where it was found. */
+int search(char *s, char *pattern, regmatch_t *matched) {
+	regex_t reg, *cached;
 	bool res;
 
+	if (VALIDATING && (cached = validating_regex(pattern)))
+		return (regexec(cached, s, 1, matched, 0) != REG_NOMATCH);
 	REG_COMPILE(reg, pattern, REG_EXTENDED);
-	res = regexec(&reg, s, 1, &matched, 0) != REG_NOMATCH;
+	res = regexec(&reg, s, 1, matched, 0) != REG_NOMATCH;
 	regfree(&reg);
 	return (res);
 }
 
+int match(char *s, char *pattern) {
+	regmatch_t matched;
+
+	return (search(s, pattern, &matched));
+}
+
 int parse_selector_sequence(selector_sequence *seq, char **s) {
 	int wide_res, small_res;
 
@@ -24,10 +117,14 @@ int parse_selector_sequence(selector_sequence *seq, char **s) {
 		return (SUCCESS);
 	}
 
+	OH_TIMER_START(wide_start);
 	wide_res  = parse_wide_range_selector(&seq->wide_range, s);
+	OH_TIMER_STOP(wide_start, wide_range_ns);
 	if (wide_res == ERROR)
 		return (ERROR);
+	OH_TIMER_START(small_start);
 	small_res = parse_small_range_selector(&seq->small_range, s);
+	OH_TIMER_STOP(small_start, small_range_ns);
 	if (small_res == ERROR)
 		return (ERROR);
 	if (wide_res == small_res && wide_res == EMPTY) {
@@ -38,30 +135,27 @@ int parse_selector_sequence(selector_sequence *seq, char **s) {
 }
 
 int parse_rule_modifier(rule_modifier *rule, char **s) {
-	regex_t reg_comment;
 	regmatch_t match_comment;
 
 	while (**s == ' ') ++*s;
 
-	REG_COMPILE(reg_comment, "^\"[^\"]*\"", REG_EXTENDED);
-
 	if (strstr(*s, "open") == *s) rule->type = RULE_OPEN, *s += sizeof("open") - 1;
 	else if (strstr(*s, "closed") == *s) rule->type = RULE_CLOSED, *s += sizeof("closed") - 1;
 	else if (strstr(*s, "off") == *s) rule->type = RULE_CLOSED, *s += sizeof("off") - 1;
 	else if (strstr(*s, "unknown") == *s) rule->type = RULE_UNKNOWN, *s += sizeof("unknown") - 1;
-	else if (regexec(&reg_comment, *s, 1, &match_comment, 0) != REG_NOMATCH) {
+	else if (search(*s, "^\"[^\"]*\"", &match_comment)) {
 		if ((*s)[1] == '"') {
 			++*s;
-			printf("Invalid syntax: empty comment.\n");
+			parse_error("Invalid syntax: empty comment.\n");
 			return (ERROR);
 		}
-		strncpy(rule->comment, *s + match_comment.rm_so + 1, match_comment.rm_eo - match_comment.rm_so - 2);
+		if (!VALIDATING)
+			strncpy(rule->comment, *s + match_comment.rm_so + 1, match_comment.rm_eo - match_comment.rm_so - 2);
 		*s += match_comment.rm_so;
 	} else if (isalpha(**s)) {
-		printf("Invalid syntax: invalid rule modifier.\n");
+		parse_error("Invalid syntax: invalid rule modifier.\n");
 		return (ERROR);
 	}
-	regfree(&reg_comment);
 	while (**s == ' ') ++*s;
 	return (SUCCESS);
 }
@@ -78,30 +172,37 @@ int parse_rule_sequence(rule_sequence *seq, char **s) {
 		return (ERROR);
 	if (parse_rule_modifier(&seq->state, s) == ERROR)
 		return (ERROR);
+	if (!VALIDATING)
+		intern_rule(seq);
 	return (SUCCESS);
 }
 
+void free_rule(rule_sequence *rule) {
+	selector_sequence selector = rule->selector;
+
+	if (selector.wide_range.type == WIDE_RANGE_DATE) {
+		release_bitset(selector.wide_range.years);
+		release_bitset(selector.wide_range.weeks);
+		release_bitset(selector.wide_range.monthdays.days);
+	}
+	release_bitset(selector.small_range.weekday.range);
+	release_bitset(selector.small_range.hours.time_range);
+	release_bitset(selector.small_range.hours.extended_time_range);
+	_oh_free(selector.small_range.hours.variable);
+}
+
 void free_oh(opening_hours oh) {
-	if (!oh)
-		return;
+	opening_hours next;
 
-	selector_sequence selector = oh->rule.selector;
-	if (selector.wide_range.years)
-		del_bitset(selector.wide_range.years);
-	if (selector.wide_range.weeks)
-		del_bitset(selector.wide_range.weeks);
-	if (selector.wide_range.monthdays.days)
-		del_bitset(selector.wide_range.monthdays.days);
-	if (selector.small_range.weekday.range)
-		del_bitset(selector.small_range.weekday.range);
-	if (selector.small_range.hours.time_range)
-		del_bitset(selector.small_range.hours.time_range);
-	if (selector.small_range.hours.extended_time_range)
-		del_bitset(selector.small_range.hours.extended_time_range);
-	if (oh->to_str)
-		free(oh->to_str);
-	free_oh(oh->next_item);
-	free(oh);
+	for (; oh; oh = next) {
+		next = oh->next_item;
+		free_rule(&oh->rule);
+		free_adaptive_order(oh->adaptive);
+		release_solar_table(oh->location.table);
+		if (oh->to_str)
+			_oh_free(oh->to_str);
+		_oh_free(oh);
+	}
 }
 
 char *set_cursor(int pos, char *str) {
@@ -111,27 +212,184 @@ char *set_cursor(int pos, char *str) {
 	return (str);
 }
 
+static void print_parse_error(char *entire_string, char *s) {
+	char cursor_str[strlen(entire_string) * 2 + 1];
+
+	printf("\n%s\n%s\n", entire_string, set_cursor(s - entire_string, cursor_str));
+}
+
 opening_hours build_opening_hours(char *s) {
-	opening_hours oh = calloc(1, sizeof(*oh)),
+	opening_hours oh = _oh_calloc(1, sizeof(*oh)),
 		      cur = oh;
 	int it = 0;
-	char *entire_string = s,
-	     cursor_str[strlen(s) * 2 + 1];
+	char *entire_string = s;
 
 	if (!oh) {
 		dprintf(2, "FATAL ERROR: Allocation failed for oh.\nMaybe RAM is full?\n");
 		exit(2);
 	}
+	OH_PARSE_BEGIN();
 	oh->rule.separator = SEP_HEAD;
 	do {
 		if (it++) {
-			cur = (cur->next_item = calloc(1, sizeof(*oh)));
+			cur = (cur->next_item = _oh_calloc(1, sizeof(*oh)));
+		}
+		cur->begin = s - entire_string;
+		if (parse_rule_sequence(&cur->rule, &s) == ERROR) {
+			print_parse_error(entire_string, s);
+			free_oh(oh);
+			return (NULL);
 		}
+		cur->end = s - entire_string;
+	} while (*s && *++s);
+	bind_evaluator(oh);
+	return (oh);
+}
+
+#define VALIDATE_STACK_SIZE 1024
+
+/*
+ * Tells whether build_opening_hours() would accept the len bytes of s,
+ * running the same grammar, but without allocating anything for the
+ * rules nor printing. Returns 1 if they are valid; otherwise returns 0,
+ * filling err (when given) with the message and the offset of the error.
+ */
+int oh_validate(const char *s, size_t len, oh_error *err) {
+	char buffer[VALIDATE_STACK_SIZE], *copy = buffer, *cur, *nul;
+	rule_sequence rule = {.separator = SEP_HEAD};
+	oh_error ignored;
+	int valid = 1;
+
+	if (!err)
+		err = &ignored;
+	err->offset = 0;
+	err->message[0] = '\0';
+	if (!s)
+		return (0);
+	/* The parsers need a terminated string: copy it, on the stack when it is short. */
+	if (len >= VALIDATE_STACK_SIZE)
+		copy = alloc_or_die(_oh_malloc(len + 1), "oh_validate");
+	memcpy(copy, s, len);
+	copy[len] = '\0';
+	if ((nul = memchr(copy, '\0', len))) {
+		err->offset = nul - copy;
+		snprintf(err->message, OH_ERROR_SIZE, "Invalid syntax: unexpected null byte.");
+		valid = 0;
+	}
+	validating = err;
+	for (cur = copy; valid;) {
+		if (parse_rule_sequence(&rule, &cur) == ERROR) {
+			err->offset = cur - copy;
+			valid = 0;
+		} else if (!*cur || !*++cur) {
+			break;
+		}
+		rule = (rule_sequence){.separator = SEP_NOT_SET};
+	}
+	validating = NULL;
+	if (copy != buffer)
+		_oh_free(copy);
+	return (valid);
+}
+
+/*
+ * Number of bytes the rule parsers may read past the end of a rule,
+ * looking for the next token. Rules holding quotes are excluded from
+ * this bound, as comments are searched for until the end of the string.
+ */
+#define REPARSE_LOOKAHEAD 8
+
+static bool rule_depends_on(opening_hours rule, char *s, size_t from) {
+	return (rule->end + REPARSE_LOOKAHEAD >= from
+			|| memchr(s + rule->begin, '"', rule->end - rule->begin + 1));
+}
+
+/*
+ * Applies an edit, the old_s[from, to) bytes having been replaced to give
+ * new_s, by reparsing only the rules the edit could change. Untouched rules
+ * are kept as they are, including the head which stays the object
+ * returned.
+ * Returns NULL, leaving oh untouched, if new_s doesn't parse, or if [from,
+ * to) is not within old_s or new_s doesn't keep the old_s bytes before it.
+ */
+opening_hours edit_opening_hours(opening_hours oh, char *old_s, size_t from, size_t to, char *new_s) {
+	size_t old_len, new_len;
+	long delta;
+	opening_hours prev = NULL,
+		      first = oh,
+		      old = oh,
+		      head = NULL,
+		      cur = NULL,
+		      next;
+	bool resynced = false;
+	char *s;
+
+	if (!oh || !old_s || !new_s || from > to)
+		return (NULL);
+	old_len = strlen(old_s);
+	new_len = strlen(new_s);
+	if (to > old_len || from > new_len)
+		return (NULL);
+	delta = (long)new_len - (long)old_len;
+	while (first->next_item && !rule_depends_on(first, old_s, from))
+		prev = first, first = first->next_item;
+
+	OH_PARSE_BEGIN();
+	s = new_s + first->begin;
+	do {
+		next = calloc_or_die(NULL, 1, sizeof(*next), "oh");
+		if (cur)
+			cur->next_item = next;
+		else
+			head = next, next->rule.separator = first == oh ? SEP_HEAD : SEP_NOT_SET;
+		cur = next;
+		cur->begin = s - new_s;
 		if (parse_rule_sequence(&cur->rule, &s) == ERROR) {
-			printf("\n%s\n%s\n", entire_string, set_cursor(s - entire_string, cursor_str));
-			free_oh(cur);
+			print_parse_error(new_s, s);
+			free_oh(head);
 			return (NULL);
 		}
+		cur->end = s - new_s;
+
+		/* Back in the unchanged tail, at the end of an old rule: the rest parses the same. */
+		if ((long)cur->end - delta >= (long)to) {
+			while (old && (long)old->end < (long)cur->end - delta)
+				old = old->next_item;
+			if ((resynced = old && (long)old->end == (long)cur->end - delta))
+				break;
+		}
 	} while (*s && *++s);
+
+	/* The old rules from first to old (or to the end) are replaced by head to cur. */
+	next = NULL;
+	if (resynced) {
+		next = old->next_item;
+		old->next_item = NULL;
+	}
+	if (first == oh) {
+		free_rule(&oh->rule);
+		oh->rule = head->rule;
+		oh->begin = head->begin;
+		oh->end = head->end;
+		old = oh->next_item;
+		oh->next_item = head->next_item;
+		if (cur == head)
+			cur = oh;
+		_oh_free(head);
+		free_oh(old);
+	} else {
+		prev->next_item = head;
+		free_oh(first);
+	}
+	cur->next_item = next;
+	for (; next; next = next->next_item) {
+		next->begin += delta;
+		next->end += delta;
+	}
+	if (oh->to_str) {
+		_oh_free(oh->to_str);
+		oh->to_str = NULL;
+	}
+	bind_evaluator(oh);
 	return (oh);
 }
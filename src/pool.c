@@ -0,0 +1,192 @@
+#include <pthread.h>
+#include <stdint.h>
+#include "parsing.h"
+#include "bitset_kernels.h"
+
+/*
+ * Pool of the selectors of built rules, shared by every object: a
+ * selector is stored once whatever the number of rules using it, with
+ * the number of references to it.
+ *
+ * The pool is split into shards, each with its own lock and hash table,
+ * so that threads building schedules together seldom wait for each other.
+ * Nodes hold the bitset itself, after the allocator they were made with:
+ * they may be released from another thread, under another allocator.
+ */
+
+#define NB_SHARDS       64
+#define SHARD(hash)     ((hash) >> 58)
+#define MIN_BUCKETS     16
+
+typedef struct pool_node pool_node;
+typedef struct pool_shard pool_shard;
+
+struct pool_node {
+	pool_node *next;
+	const oh_allocator *allocator;
+	size_t hash;
+	size_t references;
+	_word_t words[];        /* number of bits, then the bits */
+};
+
+struct pool_shard {
+	pthread_mutex_t lock;
+	pool_node **buckets;
+	size_t nb_buckets;
+	size_t nb_nodes;
+	const oh_allocator *allocator;  /* the buckets were allocated with */
+};
+
+static pool_shard shards[NB_SHARDS] = {[0 ... NB_SHARDS - 1] = {.lock = PTHREAD_MUTEX_INITIALIZER}};
+
+static size_t hash_bitset(bitset set) {
+	size_t nwords = _B_NWORDS(BITSET_SIZE(set)), i;
+	uint64_t hash = BITSET_SIZE(set) * 0x9e3779b97f4a7c15ULL;
+
+	for (i = 0; i < nwords; i++) {
+		hash = (hash ^ (uint64_t) set[i]) * 0xff51afd7ed558ccdULL;
+		hash = (hash ^ (uint64_t) (set[i] >> 64)) * 0xc4ceb9fe1a85ec53ULL;
+		hash ^= hash >> 32;
+	}
+	return (hash);
+}
+
+static bool same_bitsets(bitset a, bitset b) {
+	return (BITSET_SIZE(a) == BITSET_SIZE(b) && _bitset_ops->equal_words(a, b, _B_NWORDS(BITSET_SIZE(a))));
+}
+
+/* Doubles the buckets of a shard, whose lock is held. */
+static void grow_shard(pool_shard *shard) {
+	const oh_allocator *allocator = oh_current_allocator();
+	size_t nb_buckets = shard->nb_buckets ? shard->nb_buckets * 2 : MIN_BUCKETS, i;
+	pool_node **buckets = calloc_or_die(allocator, nb_buckets, sizeof(*buckets), "the selector pool"),
+		  *node, *next;
+
+	for (i = 0; i < shard->nb_buckets; i++) {
+		for (node = shard->buckets[i]; node; node = next) {
+			next = node->next;
+			node->next = buckets[node->hash & (nb_buckets - 1)];
+			buckets[node->hash & (nb_buckets - 1)] = node;
+		}
+	}
+	if (shard->buckets)
+		shard->allocator->free(shard->allocator->context, shard->buckets);
+	shard->buckets = buckets;
+	shard->nb_buckets = nb_buckets;
+	shard->allocator = allocator;
+}
+
+/* Node of a shard, whose lock is held, holding set itself (or a bitset equal to it, when equal is set). */
+static pool_node **find_node(pool_shard *shard, bitset set, size_t hash, bool equal) {
+	pool_node **node;
+
+	if (!shard->nb_buckets)
+		return (NULL);
+	for (node = &shard->buckets[hash & (shard->nb_buckets - 1)]; *node; node = &(*node)->next)
+		if ((*node)->words + 1 == set || (equal && (*node)->hash == hash && same_bitsets((*node)->words + 1, set)))
+			return (node);
+	return (NULL);
+}
+
+/*
+ * Returns the pooled bitset equal to set, taking a reference to it, and
+ * frees set unless it was that one. Sets equal to a shared, read-only
+ * one give that one instead, as they are equivalent.
+ */
+bitset intern_bitset(bitset set) {
+	bitset shared[] = {shared_years, shared_monthdays, shared_weeks, shared_weekdays, shared_minutes, shared_no_minutes};
+	const oh_allocator *allocator;
+	pool_shard *shard;
+	pool_node **found, *node;
+	size_t hash, i;
+
+	if (!set || is_shared_bitset(set))
+		return (set);
+	for (i = 0; i < sizeof(shared) / sizeof(*shared); i++) {
+		if (same_bitsets(shared[i], set)) {
+			del_bitset(set);
+			return (shared[i]);
+		}
+	}
+	hash = hash_bitset(set);
+	shard = &shards[SHARD(hash)];
+	pthread_mutex_lock(&shard->lock);
+	if ((found = find_node(shard, set, hash, true))) {
+		node = *found;
+		++node->references;
+	} else {
+		allocator = oh_current_allocator();
+		node = calloc_or_die(allocator, 1, sizeof(*node) + BITSET_NBYTES(set), "the selector pool");
+		node->allocator = allocator;
+		node->hash = hash;
+		node->references = 1;
+		memcpy(node->words, set - 1, BITSET_NBYTES(set));
+		if (shard->nb_nodes >= shard->nb_buckets)
+			grow_shard(shard);
+		node->next = shard->buckets[hash & (shard->nb_buckets - 1)];
+		shard->buckets[hash & (shard->nb_buckets - 1)] = node;
+		++shard->nb_nodes;
+	}
+	pthread_mutex_unlock(&shard->lock);
+	if (node->words + 1 != set)
+		del_bitset(set);
+	return (node->words + 1);
+}
+
+/* Drops a reference to a pooled bitset, or frees set if it isn't pooled. Shared sets are left alone. */
+void release_bitset(bitset set) {
+	pool_shard *shard;
+	pool_node **found, *node = NULL;
+	size_t hash;
+
+	if (!set || is_shared_bitset(set))
+		return;
+	hash = hash_bitset(set);
+	shard = &shards[SHARD(hash)];
+	pthread_mutex_lock(&shard->lock);
+	if ((found = find_node(shard, set, hash, false)) && !--(*found)->references) {
+		node = *found;
+		*found = node->next;
+		--shard->nb_nodes;
+	}
+	pthread_mutex_unlock(&shard->lock);
+	if (node)
+		node->allocator->free(node->allocator->context, node);
+	else if (!found)
+		del_bitset(set);
+}
+
+/* Number of references to a pooled bitset, 0 if set isn't pooled. */
+size_t bitset_references(bitset set) {
+	pool_shard *shard;
+	pool_node **found;
+	size_t hash, references;
+
+	if (!set || is_shared_bitset(set))
+		return (0);
+	hash = hash_bitset(set);
+	shard = &shards[SHARD(hash)];
+	pthread_mutex_lock(&shard->lock);
+	references = (found = find_node(shard, set, hash, false)) ? (*found)->references : 0;
+	pthread_mutex_unlock(&shard->lock);
+	return (references);
+}
+
+/* Bytes allocated for a bitset with that many references: pooled ones are held by a node. */
+size_t bitset_allocated_bytes(bitset set, size_t references) {
+	return (BITSET_NBYTES(set) + (references ? sizeof(pool_node) : 0));
+}
+
+/* Replaces the selectors of a finished rule by pooled ones. */
+void intern_rule(rule_sequence *rule) {
+	selector_sequence *selector = &rule->selector;
+
+	if (selector->wide_range.type == WIDE_RANGE_DATE) {
+		selector->wide_range.years = intern_bitset(selector->wide_range.years);
+		selector->wide_range.monthdays.days = intern_bitset(selector->wide_range.monthdays.days);
+		selector->wide_range.weeks = intern_bitset(selector->wide_range.weeks);
+	}
+	selector->small_range.weekday.range = intern_bitset(selector->small_range.weekday.range);
+	selector->small_range.hours.time_range = intern_bitset(selector->small_range.hours.time_range);
+	selector->small_range.hours.extended_time_range = intern_bitset(selector->small_range.hours.extended_time_range);
+}
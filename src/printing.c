@@ -1,6 +1,7 @@
 #include <string.h>
 #include <stdio.h>
 #include "opening_hours.h"
+#include "allocator.h"
 
 #ifndef BUFFER_SIZE
 # define BUFFER_SIZE 2048
@@ -8,139 +9,122 @@
 
 static char result[BUFFER_SIZE] = {0};
 
-char *strdup(const char *);
-
 void print_weeknum(bitset wn) {
-	size_t i = 0,
-		   set = 0,
-		   ever = 0;
+	size_t start, end;
+	bool ever = false;
 
 	snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "     Weeknums:");
-	do {
-		if (!set && GET_BIT(wn, i)) {
-			set = 1;
-			snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "%s %lu", ever ? "                 " : "  ", i + 1);
-		} else if (set && !(GET_BIT(wn, i))) {
-			set = 0;
-			ever = 1;
-			if (i > 1 && GET_BIT(wn, i - 2))
-				snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), " - %lu", i);
-			snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "\n");
-		}
-	} while (++i < 54);
-	if (set)
-		snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), " - 54\n");
-	else if (!ever)
+	bitset_runs(wn, 0, 54, start, end) {
+		snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "%s %lu", ever ? "                 " : "  ", start + 1);
+		if (end == 54)
+			snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), " - 54");
+		else if (end - start > 1)
+			snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), " - %lu", end);
+		snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "\n");
+		ever = true;
+	}
+	if (!ever)
 		snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "   none\n");
 }
 
+static void print_time_point(time_point point) {
+	int offset = point.minutes < 0 ? -point.minutes : point.minutes;
+
+	if (!point.event)
+		snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "%02d:%02d", point.minutes / 60, point.minutes % 60);
+	else if (!point.minutes)
+		snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "%s", SOLAR_EVENTS_STR[point.event - 1]);
+	else
+		snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "(%s%c%02d:%02d)", SOLAR_EVENTS_STR[point.event - 1],
+				point.minutes < 0 ? '-' : '+', offset / 60, offset % 60);
+}
+
 void print_hours(time_selector ts) {
-	size_t i = 0,
-		   set = 0,
-		   ever = 0;
+	size_t start, end, i;
+	bool ever = false;
 
 	snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "     Hours:");
-	do {
-		if (!set && GET_BIT(ts.time_range, i)) {
-			set = 1;
-			snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "%s %02lu:%02lu", ever ? "                 " : "      ", i / 60, i % 60);
-		} else if (set && !(GET_BIT(ts.time_range, i))) {
-			set = 0;
-			ever = 1;
-			if (i > 1 && GET_BIT(ts.time_range, i - 2)) {
-				snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), " - %02lu:%02lu", i / 60, i % 60);
-			}
-			snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "\n");
-		}
-	} while (++i < 24 * 60);
-	if (set)
-		snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "+\n");
-	else if (!ever)
+	bitset_runs(ts.time_range, 0, 24 * 60, start, end) {
+		snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "%s %02lu:%02lu", ever ? "                 " : "      ", start / 60, start % 60);
+		if (end == 24 * 60)
+			snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "+");
+		else if (end - start > 1)
+			snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), " - %02lu:%02lu", end / 60, end % 60);
+		snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "\n");
+		ever = true;
+	}
+	for (i = 0; i < ts.nb_variable; i++) {
+		snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "%s ", ever ? "                 " : "      ");
+		print_time_point(ts.variable[i].from);
+		snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), " - ");
+		print_time_point(ts.variable[i].to);
+		snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "\n");
+		ever = true;
+	}
+	if (!ever)
 		snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "       none\n");
 }
 
 void print_weekday(weekday_selector wd) {
-	size_t i = 0,
-		   set = 0,
-		   ever = 0;
+	size_t start, end;
+	bool ever = false;
 
 	snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "     Weekdays:");
-	do {
-		if (!set && GET_BIT(wd.day, i)) {
-			set = 1;
-			snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "%s %s", ever ? "                 " : "   ", WEEKDAY_STR[i]);
-		} else if (set && !(GET_BIT(wd.day, i))) {
-			set = 0;
-			ever = 1;
-			if (i > 1 && GET_BIT(wd.day, i - 2)) {
-				snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), " - %s", WEEKDAY_STR[(i - 1)]);
-			}
-			snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "\n");
-		}
-	} while (++i < 7);
-	if (set)
-		snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), " - %s\n", WEEKDAY_STR[6]);
-	else if (!ever)
+	bitset_runs(wd.day, 0, 7, start, end) {
+		snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "%s %s", ever ? "                 " : "   ", WEEKDAY_STR[start]);
+		if (end == 7 || end - start > 1)
+			snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), " - %s", WEEKDAY_STR[end - 1]);
+		snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "\n");
+		ever = true;
+	}
+	if (!ever)
 		snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "    none\n");
 }
 
 void print_months(monthday_range md) {
-	size_t i = 0,
-	       set = 0,
-	       ever = 0,
-	       from;
+	size_t start, end;
+	bool ever = false;
+	int day;
 
 	snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "     Monthdays:");
-	do {
-		if (!set && GET_BIT(md.days, i)) {
-			set = 1;
-			from = i;
-			if (i % 32)
-				snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "%s %lu %s", ever ? "                " : " ", i % 32 + 1, MONTHS_STR[i / 32]);
-			else
-				snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "%s %s", ever ? "                " : " ", MONTHS_STR[i / 32]);
-		} else if (set && !(GET_BIT(md.days, i))) {
-			set = 0;
-			ever = 1;
-			if (i > 1 && GET_BIT(md.days, i - 2)) {
-				int day = (i - 1) % 32 + 2;
-				if (day <= NB_DAYS[i / 32])
-					snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), " - %d %s", day > NB_DAYS[i / 32] ? NB_DAYS[i / 32] : day, MONTHS_STR[(i - 1) / 32]);
-				else if (strcmp(MONTHS_STR[(i - 1) / 32], MONTHS_STR[from / 32]))
-					snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), " - %s", MONTHS_STR[(i - 1) / 32]);
-			} else if (!(i % 32)) {
-				snprintf(result + strlen(result), BUFFER_SIZE, " %lu", i % 32);
-			}
-			snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "\n");
+	bitset_runs(md.days, 0, 32 * 12, start, end) {
+		if (start % 32)
+			snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "%s %lu %s", ever ? "                " : " ", start % 32 + 1, MONTHS_STR[start / 32]);
+		else
+			snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "%s %s", ever ? "                " : " ", MONTHS_STR[start / 32]);
+		if (end == 32 * 12) {
+			snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), " - %s", MONTHS_STR[11]);
+		} else if (end - start > 1) {
+			day = (end - 1) % 32 + 2;
+			if (day <= NB_DAYS[end / 32])
+				snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), " - %d %s", day, MONTHS_STR[(end - 1) / 32]);
+			else if ((end - 1) / 32 != start / 32)
+				snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), " - %s", MONTHS_STR[(end - 1) / 32]);
+		} else if (!(end % 32)) {
+			snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), " %lu", end % 32);
 		}
-	} while (++i < 32 * 12);
-	if (set)
-		snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), " - %s\n", MONTHS_STR[11]);
-	else if (!ever)
+		snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "\n");
+		ever = true;
+	}
+	if (!ever)
 		snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "  none\n");
 }
 
 void print_years(bitset years) {
-	size_t i = 0,
-		   set = 0,
-		   ever = 0;
+	size_t start, end;
+	bool ever = false;
 
 	snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "     Years:");
-	do {
-		if (!set && GET_BIT(years, i)) {
-			set = 1;
-			snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "%s %lu", ever ? "                " : "     ", i + 1900);
-		} else if (set && !(GET_BIT(years, i))) {
-			set = 0;
-			ever = 1;
-			if (i > 1 && GET_BIT(years, i - 2))
-				snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), " - %lu", i + 1899);
-			snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "\n");
-		}
-	} while (++i < 1024);
-	if (set)
-		snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "+\n");
-	else if (!ever)
+	bitset_runs(years, 0, 1024, start, end) {
+		snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "%s %lu", ever ? "                " : "     ", start + 1900);
+		if (end == 1024)
+			snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "+");
+		else if (end - start > 1)
+			snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), " - %lu", end + 1899);
+		snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "\n");
+		ever = true;
+	}
+	if (!ever)
 		snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "      none\n");
 }
 
@@ -177,6 +161,7 @@ char *print_oh(opening_hours oh) {
 		if ((cur = cur->next_item))
 			snprintf(result + strlen(result), BUFFER_SIZE - strlen(result), "====================================\n\n");
 	} while (cur);
-	oh->to_str = strdup(result);
+	oh->to_str = _oh_malloc(strlen(result) + 1);
+	strcpy(oh->to_str, result);
 	return (oh->to_str);
 }
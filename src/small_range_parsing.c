@@ -16,14 +16,14 @@ int parse_weekday_selector(weekday_selector *selector, char **s) {
 	char sep_char = 0,
 		 weekday_id, weekday_to;
 
-	selector->range = Bitset(7);
+	selector->range = NULL;
 
 	do {
 		while (**s == ' ') ++*s;
 		if (strstr(*s, "SH ") == *s) {
 			*s += sizeof("SH");
 			if (**s != ' ' && **s != ',' && **s) {
-				printf("Invalid syntax: if you want to select a single day holiday, you need\n                to put a space or a coma.\n");
+				parse_error("Invalid syntax: if you want to select a single day holiday, you need\n                to put a space or a coma.\n");
 				return (ERROR);
 			}
 			if ((sep_char = **s))
@@ -34,7 +34,7 @@ int parse_weekday_selector(weekday_selector *selector, char **s) {
 		if (strstr(*s, "PH ") == *s) {
 			*s += sizeof("PH");
 			if (**s != ' ' && **s != ',' && **s) {
-				printf("Invalid syntax: if you want to select a plural day holiday, you need\n                to put a space or a coma.\n");
+				parse_error("Invalid syntax: if you want to select a plural day holiday, you need\n                to put a space or a coma.\n");
 				return (ERROR);
 			}
 			if ((sep_char = **s))
@@ -44,12 +44,17 @@ int parse_weekday_selector(weekday_selector *selector, char **s) {
 		if ((weekday_id = get_weekday_id(*s)) == 7) {
 			if (sep_char == ',') {
 				--*s;
-				printf("Invalid selector: expected weekday.\n");
+				parse_error("Invalid selector: expected weekday.\n");
 				return (ERROR);
 			}
-			set_subset(selector->range, 0, 6, true);
+			/* Every weekday ends up selected, whatever came before. */
+			if (selector->range)
+				del_bitset(selector->range);
+			selector->range = shared_weekdays;
 			return (EMPTY);
 		}
+		if (!selector->range)
+			selector->range = PARSE_BITSET(7);
 		while (**s == ' ') ++*s;
 		*s += 2;
 		while (**s == ' ') ++*s;
@@ -57,23 +62,23 @@ int parse_weekday_selector(weekday_selector *selector, char **s) {
 			++*s;
 			while (**s == ' ') ++*s;
 			if ((weekday_to = get_weekday_id(*s)) == 7) {
-				printf("Invalid range: weekday range not enclosed by another weekday.\n");
+				parse_error("Invalid range: weekday range not enclosed by another weekday.\n");
 				return (ERROR);
 			}
 			if (weekday_id < weekday_to)
-				set_subset(selector->range, weekday_id, weekday_to, true);
+				PARSE_SET_SUBSET(selector->range, weekday_id, weekday_to, true);
 			else {
-				set_subset(selector->range, 0, 6, true);
-				set_subset(selector->range, weekday_to + 1, weekday_id - 1, false);
+				PARSE_SET_SUBSET(selector->range, 0, 6, true);
+				PARSE_SET_SUBSET(selector->range, weekday_to + 1, weekday_id - 1, false);
 			}
 			*s += 2;
 		} else {
-			SET_BIT(selector->day, weekday_id, true);
+			PARSE_SET_BIT(selector->day, weekday_id, true);
 			while (**s == ' ') ++*s;
 			if (**s == '[') {
 				while (**s == ' ') ++*s;
 				if (**s < '1' || **s > '5') {
-					printf("Invalid syntax: expected value between 1 and 5 included.\n               Expected nth of month selector.\n");
+					parse_error("Invalid syntax: expected value between 1 and 5 included.\n               Expected nth of month selector.\n");
 					return (ERROR);
 				}
 				selector->type = WD_NTH_OF_MONTH;
@@ -81,13 +86,13 @@ int parse_weekday_selector(weekday_selector *selector, char **s) {
 				++*s;
 				while (**s == ' ') ++*s;
 				if (**s != ']') {
-					printf("Invalid syntax: unenclosed bracket. Expected ']' to enclose nth of month selector.\n");
+					parse_error("Invalid syntax: unenclosed bracket. Expected ']' to enclose nth of month selector.\n");
 					return (ERROR);
 				}
 			}
 			while (**s == ' ') ++*s;
 			if (**s == '-') {
-				printf("Invalid syntax: unexpected token '-'. Cannot set a range involving nth of month.\n");
+				parse_error("Invalid syntax: unexpected token '-'. Cannot set a range involving nth of month.\n");
 				return (ERROR);
 			}
 		}
@@ -96,42 +101,187 @@ int parse_weekday_selector(weekday_selector *selector, char **s) {
 	return (SUCCESS);
 }
 
+/* Solar event at the start of s, or SOLAR_NONE. */
+static solar_event get_solar_event(char *s) {
+	size_t i, len;
+
+	for (i = 0; i < 4; i++)
+		if (!strncmp(s, SOLAR_EVENTS_STR[i], (len = strlen(SOLAR_EVENTS_STR[i]))) && !isalpha(s[len]))
+			return (i + 1);
+	return (SOLAR_NONE);
+}
+
+#define VARIABLE_TIME(s)  (*(s) == '(' || get_solar_event(s))
+
+/* Parses an event, or an event and an offset in brackets, as "(sunset-01:30)". */
+static int parse_variable_time(time_point *point, char **s) {
+	bool bracket = **s == '(';
+	int sign, hours, mins;
+
+	if (bracket) {
+		++*s;
+		while (**s == ' ') ++*s;
+	}
+	if (!(point->event = get_solar_event(*s))) {
+		parse_error("Invalid syntax: expected sunrise, sunset, dawn or dusk.\n");
+		return (ERROR);
+	}
+	*s += strlen(SOLAR_EVENTS_STR[point->event - 1]);
+	point->minutes = 0;
+	if (!bracket)
+		return (SUCCESS);
+	while (**s == ' ') ++*s;
+	if (**s != '+' && **s != '-') {
+		parse_error("Invalid syntax: expected '+' or '-', followed by the offset from the event.\n");
+		return (ERROR);
+	}
+	sign = **s == '-' ? -1 : 1;
+	++*s;
+	while (**s == ' ') ++*s;
+	if (!isdigit(**s)) {
+		parse_error("Invalid syntax: expected the offset from the event, as hh:mm.\n");
+		return (ERROR);
+	}
+	if ((hours = atoi(*s)) > 23) {
+		parse_error("Invalid range: offsets from events must be less than 24 hours.\n");
+		return (ERROR);
+	}
+	while (isdigit(**s)) ++*s;
+	if (**s != ':') {
+		parse_error("Invalid syntax: expected ':' to separate the hours of the offset from its minutes.\n");
+		return (ERROR);
+	}
+	++*s;
+	if (!isdigit(**s)) {
+		parse_error("Invalid syntax: expected number of minutes.\n");
+		return (ERROR);
+	}
+	if ((mins = atoi(*s)) > 59) {
+		parse_error("Invalid range: are you really sure that such a minute does exist in an hour?\n");
+		return (ERROR);
+	}
+	while (isdigit(**s)) ++*s;
+	while (**s == ' ') ++*s;
+	if (**s != ')') {
+		parse_error("Invalid syntax: unenclosed bracket. Expected ')' to enclose variable time.\n");
+		return (ERROR);
+	}
+	++*s;
+	point->minutes = sign * (hours * 60 + mins);
+	return (SUCCESS);
+}
+
+/* Parses a fixed time of the end of a span, as hh:mm, up to 48:00 (extended time). */
+static int parse_fixed_time(time_point *point, char **s) {
+	int hours, mins;
+
+	if ((hours = atoi(*s)) > 47) {
+		parse_error("Invalid range: the enclosing range hour need to be less than 48 (extended time).\n");
+		return (ERROR);
+	}
+	while (isdigit(**s)) ++*s;
+	if (**s != ':' && **s != 'h') {
+		parse_error("Invalid syntax: unexpected token '%c'.\n                Only ':' and 'h' are allowed to separate hours from their minutes.\n", **s);
+		return (ERROR);
+	}
+	++*s;
+	if ((mins = isdigit(**s) ? atoi(*s) : 0) > 59) {
+		parse_error("Invalid range: are you really sure that such a minute does exist in an hour?\n");
+		return (ERROR);
+	}
+	while (isdigit(**s)) ++*s;
+	*point = (time_point){SOLAR_NONE, hours * 60 + mins};
+	return (SUCCESS);
+}
+
+static void add_variable_span(time_selector *selector, time_point from, time_point to) {
+	if (VALIDATING)
+		return;
+	selector->variable = alloc_or_die(_oh_realloc(selector->variable, (selector->nb_variable + 1) * sizeof(*selector->variable)),
+			"variable times");
+	selector->variable[selector->nb_variable++] = (variable_span){from, to};
+}
+
+/*
+ * Parses a span of hours starting at a variable time, ending at another
+ * one, at a fixed time, or at midnight when followed by '+'.
+ */
+static int parse_variable_span(time_selector *selector, char **s) {
+	time_point from, to = {SOLAR_NONE, 24 * 60};
+
+	if (parse_variable_time(&from, s) == ERROR)
+		return (ERROR);
+	while (**s == ' ') ++*s;
+	if (**s == '+') {
+		++*s;
+	} else {
+		if (**s != '-') {
+			parse_error("Invalid syntax: expected range, separated by '-' token.\n");
+			return (ERROR);
+		}
+		++*s;
+		while (**s == ' ') ++*s;
+		if (isdigit(**s)) {
+			if (parse_fixed_time(&to, s) == ERROR)
+				return (ERROR);
+		} else if (!VARIABLE_TIME(*s)) {
+			parse_error("Invalid syntax: expected enclosing range hour.\n");
+			return (ERROR);
+		} else if (parse_variable_time(&to, s) == ERROR) {
+			return (ERROR);
+		} else if (to.event == from.event && to.minutes <= from.minutes) {
+			parse_error("Invalid range: the enclosing time needs to be after the opening time.\n");
+			return (ERROR);
+		}
+	}
+	add_variable_span(selector, from, to);
+	return (SUCCESS);
+}
+
 int parse_time_selector(time_selector *selector, char **s) {
 	int hours_from = 0, hours_to = 0,
 		mins_from = 0, mins_to = 0,
-		extended_hour;
+		extended_hour, variable_spans = 0;
 	char hourmin_sep;
+	time_point from, to;
 
-	selector->time_range = Bitset(60 * 24);
-	selector->extended_time_range = Bitset(60 * 24);
+	selector->time_range = NULL;
+	selector->extended_time_range = shared_no_minutes;
 
 	do {
 		while (**s == ' ') ++*s;
+		if (VARIABLE_TIME(*s)) {
+			if (parse_variable_span(selector, s) == ERROR)
+				return (ERROR);
+			++variable_spans;
+			while (**s == ' ') ++*s;
+			continue;
+		}
 		if (!isdigit(**s)) {
-			if (!(hours_from | hours_to | mins_from | mins_to)) {
-				set_subset(selector->time_range, 0, 24 * 60, true);
+			if (!(hours_from | hours_to | mins_from | mins_to | variable_spans)) {
+				selector->time_range = shared_minutes;
 				return (EMPTY);
 			}
-			printf("Invalid syntax: unexpected token.\n");
+			parse_error("Invalid syntax: unexpected token.\n");
 			return (ERROR);
 		}
 		if ((hours_from = atoi(*s)) > 23) {
-			printf("Invalid range: are you really sure that such an hour does exist?\n");
+			parse_error("Invalid range: are you really sure that such an hour does exist?\n");
 			return (ERROR);
 		}
 		while (isdigit(**s)) ++*s;
 		if ((hourmin_sep = **s) != ':' && **s != 'h') {
-			printf("Invalid syntax: unexpected token '%c'.\n                Only ':' and 'h' are allowed to separate hours from their minutes.\n", **s);
+			parse_error("Invalid syntax: unexpected token '%c'.\n                Only ':' and 'h' are allowed to separate hours from their minutes.\n", **s);
 			return (ERROR);
 		}
 		++*s;
 		while (**s == ' ') ++*s;
 		if (!isdigit(**s) && hourmin_sep != 'h') {
-			printf("Invalid syntax: expected number of minutes.\n");
+			parse_error("Invalid syntax: expected number of minutes.\n");
 			return (ERROR);
 		}
 		if ((mins_from = atoi(*s)) > 59) {
-			printf("Invalid range: are you really sure that such a minute does exist in an hour?\n");
+			parse_error("Invalid range: are you really sure that such a minute does exist in an hour?\n");
 			return (ERROR);
 		}
 		while (isdigit(**s)) ++*s;
@@ -142,47 +292,64 @@ int parse_time_selector(time_selector *selector, char **s) {
 			mins_to = 0;
 		} else {
 			if (**s != '-') {
-				printf("Invalid syntax: expected range, separated by '-' token.\n");
+				parse_error("Invalid syntax: expected range, separated by '-' token.\n");
 				return (ERROR);
 			}
 			++*s;
 			while (**s == ' ') ++*s;
+			if (VARIABLE_TIME(*s)) {
+				if (parse_variable_time(&to, s) == ERROR)
+					return (ERROR);
+				from = (time_point){SOLAR_NONE, hours_from * 60 + mins_from};
+				add_variable_span(selector, from, to);
+				++variable_spans;
+				while (**s == ' ') ++*s;
+				continue;
+			}
 			if (!isdigit(**s)) {
-				printf("Invalid syntax: expected enclosing range hour.\n");
+				parse_error("Invalid syntax: expected enclosing range hour.\n");
 				return (ERROR);
 			}
 			if ((hours_to = atoi(*s)) > 47) {
-				printf("Invalid range: the enclosing range hour need to be less than 48 (extended time).\n");
+				parse_error("Invalid range: the enclosing range hour need to be less than 48 (extended time).\n");
 				return (ERROR);
 			}
 			while (isdigit(**s)) ++*s;
 			if ((hourmin_sep = **s) != ':' && **s != 'h') {
-				printf("Invalid syntax: unexpected token '%c'.\n                Only ':' and 'h' are allowed to separate hours from their minutes.", **s);
+				parse_error("Invalid syntax: unexpected token '%c'.\n                Only ':' and 'h' are allowed to separate hours from their minutes.", **s);
 				return (ERROR);
 			}
 			++*s;
 			while (**s == ' ') ++*s;
 			if (!isdigit(**s) && hourmin_sep != 'h') {
-				printf("Invalid syntax: expected number of minutes.\n");
+				parse_error("Invalid syntax: expected number of minutes.\n");
 				return (ERROR);
 			}
 			if ((mins_to = atoi(*s)) > 59) {
-				printf("Invalid range: are you really sure that such a minute does exist in an hour?\n");
+				parse_error("Invalid range: are you really sure that such a minute does exist in an hour?\n");
 				return (ERROR);
 			}
 		}
 		if (hours_to < hours_from || (hours_to == hours_from && mins_to <= mins_from)) {
-			printf("Invalid range: the enclosing range hour needs to be greater than the opening hour.\n               If you want to mean the tomorrow's hour, please use the extended time syntax.\n               For this purpose, you can specify an enclosing range hour greater than 23.\n");
-			while (**s != '-') --*s;
+			parse_error("Invalid range: the enclosing range hour needs to be greater than the opening hour.\n               If you want to mean the tomorrow's hour, please use the extended time syntax.\n               For this purpose, you can specify an enclosing range hour greater than 23.\n");
+			do --*s; while (**s != '-');
 			while (!isdigit(**s)) ++*s;
 			return (ERROR);
 		}
-		set_subset(selector->time_range, hours_from * 60 + mins_from, hours_to * 60 + mins_to - 1, true);
-		if ((extended_hour = hours_to * 60 + mins_to - 24 * 60) > 0)
-			set_subset(selector->extended_time_range, 0, extended_hour, true);
+		if (!selector->time_range)
+			selector->time_range = PARSE_BITSET(60 * 24);
+		PARSE_SET_SUBSET(selector->time_range, hours_from * 60 + mins_from, hours_to * 60 + mins_to - 1, true);
+		if ((extended_hour = hours_to * 60 + mins_to - 24 * 60) > 0) {
+			if (selector->extended_time_range == shared_no_minutes)
+				selector->extended_time_range = PARSE_BITSET(60 * 24);
+			PARSE_SET_SUBSET(selector->extended_time_range, 0, extended_hour - 1, true);
+		}
 		while (isdigit(**s)) ++*s;
 		while (**s == ' ') ++*s;
 	} while (**s == ',' && *(++*s));
+	/* Variable times only. */
+	if (!selector->time_range && !VALIDATING)
+		selector->time_range = shared_no_minutes;
 	return (SUCCESS);
 }
 
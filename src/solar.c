@@ -0,0 +1,235 @@
+#include <math.h>
+#include <pthread.h>
+#include "normalize.h"
+#include "parsing.h"
+
+/*
+ * Variable times: spans of hours starting or ending at dawn, sunrise,
+ * sunset or dusk (see oh_set_location()).
+ *
+ * Computing a solar event takes some trigonometry, so it is done once for
+ * each cell of a CELL_DEGREES grid, for every monthday (of a leap year),
+ * and the table is shared by every schedule located in that cell: is_open()
+ * then only looks a minute up. Tables hold UTC minutes at the middle of
+ * their cell; schedules keep the shift to their own longitude and time
+ * zone. The NOAA approximations used are within a couple of minutes of the
+ * actual times, away from the poles.
+ */
+
+#define CELL_DEGREES      0.1
+#define NB_LAT_CELLS      1800
+#define NB_LON_CELLS      3600
+#define NB_TABLE_BUCKETS  256
+
+#define FLOOR_DIV(a, b)   ((a) / (b) - ((a) % (b) < 0))
+#define PI                3.14159265358979323846
+#define RADIANS(degrees)  ((degrees) * PI / 180)
+#define DEGREES(radians)  ((radians) * 180 / PI)
+
+struct solar_table {
+	solar_table *next;
+	const oh_allocator *allocator;
+	long cell;
+	size_t references;
+	short minutes[NB_MONTHDAYS][4];         /* UTC, of each event of SOLAR_EVENTS_STR */
+};
+
+/* Times used by schedules without a location: */
+static const int default_minutes[] = {0, 5 * 60 + 30, 6 * 60, 18 * 60, 18 * 60 + 30};
+
+static solar_table *tables[NB_TABLE_BUCKETS];
+static pthread_mutex_t tables_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Minutes after midnight (UTC) the sun crosses zenith_degrees in the morning
+ * and in the evening, at a given day of the year (0 being Jan 1st) and
+ * location. At the poles, where it doesn't, both are noon in the polar night
+ * and a whole day apart in the polar day.
+ */
+static void crossings(int day, double latitude, double longitude, double zenith_degrees, double *morning, double *evening) {
+	double gamma = 2 * PI / 366 * day,
+	       equation = 229.18 * (0.000075 + 0.001868 * cos(gamma) - 0.032077 * sin(gamma)
+			       - 0.014615 * cos(2 * gamma) - 0.040849 * sin(2 * gamma)),
+	       declination = 0.006918 - 0.399912 * cos(gamma) + 0.070257 * sin(gamma) - 0.006758 * cos(2 * gamma)
+		       + 0.000907 * sin(2 * gamma) - 0.002697 * cos(3 * gamma) + 0.00148 * sin(3 * gamma),
+	       cos_angle = cos(RADIANS(zenith_degrees)) / (cos(RADIANS(latitude)) * cos(declination))
+		       - tan(RADIANS(latitude)) * tan(declination),
+	       angle = DEGREES(acos(_MAX(-1.0, _MIN(1.0, cos_angle))));
+
+	*morning = 720 - 4 * (longitude + angle) - equation;
+	*evening = 720 - 4 * (longitude - angle) - equation;
+}
+
+static void fill_table(solar_table *table) {
+	double latitude = (table->cell / NB_LON_CELLS + 0.5) * CELL_DEGREES - 90,
+	       longitude = (table->cell % NB_LON_CELLS + 0.5) * CELL_DEGREES - 180,
+	       morning, evening;
+	int day = 0, monthday;
+
+	for (monthday = 0; monthday < NB_MONTHDAYS; monthday++) {
+		if (!valid_monthday(monthday))
+			continue;
+		/* Civil twilight, then sunrise and sunset, allowing for refraction. */
+		crossings(day, latitude, longitude, 96, &morning, &evening);
+		table->minutes[monthday][SOLAR_DAWN - 1] = lround(morning);
+		table->minutes[monthday][SOLAR_DUSK - 1] = lround(evening);
+		crossings(day, latitude, longitude, 90.833, &morning, &evening);
+		table->minutes[monthday][SOLAR_SUNRISE - 1] = lround(morning);
+		table->minutes[monthday][SOLAR_SUNSET - 1] = lround(evening);
+		++day;
+	}
+}
+
+/* Table of a cell of the grid, taking a reference to it. */
+static solar_table *acquire_solar_table(long cell) {
+	const oh_allocator *allocator;
+	solar_table *table;
+
+	pthread_mutex_lock(&tables_lock);
+	for (table = tables[cell % NB_TABLE_BUCKETS]; table && table->cell != cell; table = table->next);
+	if (table) {
+		++table->references;
+	} else {
+		allocator = oh_current_allocator();
+		table = calloc_or_die(allocator, 1, sizeof(*table), "solar table");
+		table->allocator = allocator;
+		table->cell = cell;
+		table->references = 1;
+		fill_table(table);
+		table->next = tables[cell % NB_TABLE_BUCKETS];
+		tables[cell % NB_TABLE_BUCKETS] = table;
+	}
+	pthread_mutex_unlock(&tables_lock);
+	return (table);
+}
+
+void release_solar_table(solar_table *table) {
+	solar_table **link;
+
+	if (!table)
+		return;
+	pthread_mutex_lock(&tables_lock);
+	if (--table->references) {
+		table = NULL;
+	} else {
+		for (link = &tables[table->cell % NB_TABLE_BUCKETS]; *link != table; link = &(*link)->next);
+		*link = table->next;
+	}
+	pthread_mutex_unlock(&tables_lock);
+	if (table)
+		table->allocator->free(table->allocator->context, table);
+}
+
+/* Bytes of the table of a location, shared by the schedules of its cell. */
+size_t solar_table_bytes(const solar_location *location) {
+	return (location->table ? sizeof(*location->table) : 0);
+}
+
+/* Local minute of an event, at monthday (month * 32 + day - 1), from the midnight starting the day. */
+int solar_minute(const solar_location *location, int monthday, solar_event event) {
+	if (!location->table)
+		return (default_minutes[event]);
+	return (location->table->minutes[monthday][event - 1] + location->shift);
+}
+
+static int point_minute(const solar_location *location, time_point *point, int monthday) {
+	return (point->event ? solar_minute(location, monthday, point->event) + point->minutes : point->minutes);
+}
+
+/*
+ * Minutes a span holds at monthday, [*from, *to) from the midnight starting
+ * the day: *from is in the day, *to may be in the next one. A span ending
+ * before it starts ends the next day; returns false if it is empty.
+ */
+static bool span_bounds(const solar_location *location, variable_span *span, int monthday, int *from, int *to) {
+	int days;
+
+	*from = point_minute(location, &span->from, monthday);
+	*to = point_minute(location, &span->to, monthday);
+	days = FLOOR_DIV(*from, DAY_MINUTES);
+	*from -= days * DAY_MINUTES;
+	*to -= days * DAY_MINUTES;
+	while (*to < *from)
+		*to += DAY_MINUTES;
+	*to = _MIN(*to, *from + DAY_MINUTES);
+	return (*to > *from);
+}
+
+static int previous_monthday(int monthday) {
+	int month = (monthday / 32 + 11) % 12;
+
+	return (monthday % 32 ? monthday - 1 : month * 32 + NB_DAYS[month] - 1);
+}
+
+/*
+ * Whether the variable spans of hours of a small range hold minute at
+ * monthday, a weekday (Mo = 0): the spans of that day, or those of the day
+ * before going on past midnight.
+ */
+bool variable_hours_match(const solar_location *location, small_range_selector *small, int monthday, int weekday,
+		int minute) {
+	time_selector *hours = &small->hours;
+	bool today = PROBE(small->weekday.range, weekday),
+	     yesterday = PROBE(small->weekday.range, (weekday + 6) % 7);
+	int previous = previous_monthday(monthday), from, to;
+	size_t i;
+
+	for (i = 0; i < hours->nb_variable; i++) {
+		if (today && span_bounds(location, &hours->variable[i], monthday, &from, &to) && minute >= from && minute < to)
+			return (true);
+		if (yesterday && span_bounds(location, &hours->variable[i], previous, &from, &to) && minute + DAY_MINUTES < to)
+			return (true);
+	}
+	return (false);
+}
+
+/* Sets the [from, to) bits of a day. */
+static void set_minutes(_word_t *slice, int from, int to) {
+	while (from < to) {
+		if (!_B_OFFSET(from) && from + (int) _WORD_SIZE <= to) {
+			slice[_B_INDEX(from)] = ~ (_word_t) 0;
+			from += _WORD_SIZE;
+		} else {
+			SET_BIT(slice, from, true);
+			++from;
+		}
+	}
+}
+
+/* Sets the minutes variable_hours_match() holds, for a whole day. */
+void variable_hours_day(const solar_location *location, time_selector *hours, int monthday, bool today, bool yesterday,
+		_word_t *slice) {
+	int previous = previous_monthday(monthday), from, to;
+	size_t i;
+
+	for (i = 0; i < hours->nb_variable; i++) {
+		if (today && span_bounds(location, &hours->variable[i], monthday, &from, &to))
+			set_minutes(slice, from, _MIN(to, DAY_MINUTES));
+		if (yesterday && span_bounds(location, &hours->variable[i], previous, &from, &to) && to > DAY_MINUTES)
+			set_minutes(slice, 0, to - DAY_MINUTES);
+	}
+}
+
+/*
+ * Locates oh, for its variable times: latitude and longitude are in
+ * degrees (north and east being positive), utc_offset is the offset from
+ * UTC, in minutes, of the dates is_open() is given. Without a location,
+ * dawn is at 05:30, sunrise at 06:00, sunset at 18:00 and dusk at 18:30.
+ * Must not be called while other threads use oh. Returns 1, or 0 if oh is
+ * NULL or the location is invalid.
+ */
+int oh_set_location(opening_hours oh, double latitude, double longitude, int utc_offset) {
+	long lat_cell, lon_cell;
+	solar_table *table;
+
+	if (!oh || !(latitude >= -90 && latitude <= 90) || !(longitude >= -180 && longitude <= 180)
+			|| utc_offset < -DAY_MINUTES || utc_offset > DAY_MINUTES)
+		return (0);
+	lat_cell = _MIN((long) ((latitude + 90) / CELL_DEGREES), NB_LAT_CELLS - 1);
+	lon_cell = _MIN((long) ((longitude + 180) / CELL_DEGREES), NB_LON_CELLS - 1);
+	table = acquire_solar_table(lat_cell * NB_LON_CELLS + lon_cell);
+	release_solar_table(oh->location.table);
+	oh->location.table = table;
+	oh->location.shift = utc_offset - lround(4 * (longitude - ((lon_cell + 0.5) * CELL_DEGREES - 180)));
+	return (1);
+}
@@ -0,0 +1,312 @@
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include "opening_hours.h"
+#include "allocator.h"
+
+/*
+ * Concurrent store of compiled schedules, keyed by POI id.
+ *
+ * Readers never lock: they announce themselves by publishing the global
+ * epoch they started in, then walk the hash table with atomic loads.
+ * Writers are serialized by a mutex. They publish changes with atomic
+ * stores (a new schedule in an entry, an unlinked entry, a grown table),
+ * and retire what they replaced, tagged with the epoch it was retired
+ * in. The epoch is then advanced, and retired items are only freed once
+ * every reader still inside started after them.
+ */
+
+#define LOAD(var)         __atomic_load_n(&(var), __ATOMIC_SEQ_CST)
+#define STORE(var, value) __atomic_store_n(&(var), value, __ATOMIC_SEQ_CST)
+
+#define MIN_BUCKETS       64
+#define HASH(id, mask)    ((size_t) (((id) * 0x9e3779b97f4a7c15ULL) >> 32) & (mask))
+
+typedef struct store_entry store_entry;
+typedef struct store_table store_table;
+typedef struct store_reader store_reader;
+typedef struct retired retired;
+
+typedef enum retired_type {
+	RETIRED_OH = 0,
+	RETIRED_ENTRY,
+	RETIRED_TABLE
+} retired_type;
+
+struct store_entry {
+	unsigned long long id;
+	opening_hours oh;
+	store_entry *next;
+};
+
+struct store_table {
+	size_t mask;
+	store_entry *buckets[];
+};
+
+/* Registration of a reading thread. state is 0 outside reads, else 1 + the epoch it started in. */
+struct store_reader {
+	unsigned long state;
+	unsigned int nesting;
+	int in_use;
+	store_reader *next;
+};
+
+struct retired {
+	retired_type type;
+	void *ptr;
+	unsigned long epoch;
+};
+
+struct oh_store {
+	store_table *table;
+	unsigned long epoch;
+	store_reader *readers;
+	pthread_key_t reader_key;
+	pthread_mutex_t write_lock;
+	size_t size;
+	retired *retired;
+	size_t nb_retired;
+	size_t retired_capacity;
+};
+
+static store_table *new_table(size_t nb_buckets) {
+	store_table *table = calloc_or_die(NULL, 1, sizeof(*table) + nb_buckets * sizeof(store_entry *), "oh_store");
+
+	table->mask = nb_buckets - 1;
+	return (table);
+}
+
+static void release_reader(void *reader) {
+	STORE(((store_reader *)reader)->in_use, 0);
+}
+
+oh_store *oh_store_new(size_t capacity) {
+	oh_store *store = calloc_or_die(NULL, 1, sizeof(*store), "oh_store");
+	size_t nb_buckets = MIN_BUCKETS;
+
+	while (nb_buckets < capacity)
+		nb_buckets <<= 1;
+	store->table = new_table(nb_buckets);
+	pthread_mutex_init(&store->write_lock, NULL);
+	pthread_key_create(&store->reader_key, release_reader);
+	return (store);
+}
+
+/* Frees the store and every schedule in it. No thread may use it anymore. */
+void oh_store_free(oh_store *store) {
+	store_reader *reader, *next_reader;
+	store_entry *entry, *next_entry;
+	size_t i;
+
+	if (!store)
+		return;
+	pthread_key_delete(store->reader_key);
+	for (i = 0; i < store->nb_retired; i++) {
+		if (store->retired[i].type == RETIRED_OH)
+			free_oh(store->retired[i].ptr);
+		else
+			_oh_free(store->retired[i].ptr);
+	}
+	_oh_free(store->retired);
+	for (i = 0; i <= store->table->mask; i++) {
+		for (entry = store->table->buckets[i]; entry; entry = next_entry) {
+			next_entry = entry->next;
+			free_oh(entry->oh);
+			_oh_free(entry);
+		}
+	}
+	_oh_free(store->table);
+	for (reader = store->readers; reader; reader = next_reader) {
+		next_reader = reader->next;
+		_oh_free(reader);
+	}
+	pthread_mutex_destroy(&store->write_lock);
+	_oh_free(store);
+}
+
+/*
+ * Readers:
+ */
+
+static store_reader *current_reader(oh_store *store) {
+	store_reader *reader = pthread_getspecific(store->reader_key);
+	int unused;
+
+	if (reader)
+		return (reader);
+	/* Records of exited threads are reused. */
+	for (reader = LOAD(store->readers); reader; reader = reader->next) {
+		unused = 0;
+		if (__atomic_compare_exchange_n(&reader->in_use, &unused, 1, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+			break;
+	}
+	if (!reader) {
+		reader = calloc_or_die(NULL, 1, sizeof(*reader), "oh_store");
+		reader->in_use = 1;
+		reader->next = LOAD(store->readers);
+		while (!__atomic_compare_exchange_n(&store->readers, &reader->next, reader, false,
+					__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+	}
+	pthread_setspecific(store->reader_key, reader);
+	return (reader);
+}
+
+/*
+ * Starts a read section: schedules returned by oh_store_get() stay valid
+ * until the matching oh_store_read_end(). Sections may be nested.
+ */
+void oh_store_read_begin(oh_store *store) {
+	store_reader *reader = current_reader(store);
+
+	if (!reader->nesting++)
+		STORE(reader->state, LOAD(store->epoch) + 1);
+}
+
+void oh_store_read_end(oh_store *store) {
+	store_reader *reader = pthread_getspecific(store->reader_key);
+
+	if (reader && reader->nesting && !--reader->nesting)
+		STORE(reader->state, 0);
+}
+
+static store_entry *find_entry(store_table *table, unsigned long long id) {
+	store_entry *entry;
+
+	for (entry = LOAD(table->buckets[HASH(id, table->mask)]); entry; entry = LOAD(entry->next))
+		if (entry->id == id)
+			return (entry);
+	return (NULL);
+}
+
+/* Returns the schedule stored for id, or NULL. Only call it inside a read section. */
+opening_hours oh_store_get(oh_store *store, unsigned long long id) {
+	store_entry *entry = find_entry(LOAD(store->table), id);
+
+	return (entry ? LOAD(entry->oh) : NULL);
+}
+
+/* Returns is_open() of the schedule stored for id, or -1 if there is none. */
+int oh_store_is_open(oh_store *store, unsigned long long id, when date) {
+	opening_hours oh;
+	int res = -1;
+
+	oh_store_read_begin(store);
+	if ((oh = oh_store_get(store, id)))
+		res = is_open(oh, date);
+	oh_store_read_end(store);
+	return (res);
+}
+
+size_t oh_store_size(oh_store *store) {
+	return (LOAD(store->size));
+}
+
+/*
+ * Writers, all holding write_lock:
+ */
+
+static void retire(oh_store *store, retired_type type, void *ptr) {
+	if (store->nb_retired == store->retired_capacity) {
+		store->retired_capacity = store->retired_capacity ? store->retired_capacity * 2 : 64;
+		store->retired = alloc_or_die(_oh_realloc(store->retired, store->retired_capacity * sizeof(*store->retired)),
+				"oh_store");
+	}
+	store->retired[store->nb_retired++] = (retired){type, ptr, LOAD(store->epoch)};
+}
+
+/* Advances the epoch, then frees what no reader can reach anymore. */
+static void collect(oh_store *store) {
+	unsigned long oldest = __atomic_add_fetch(&store->epoch, 1, __ATOMIC_SEQ_CST), state;
+	store_reader *reader;
+	size_t i, kept = 0;
+
+	for (reader = LOAD(store->readers); reader; reader = reader->next)
+		if ((state = LOAD(reader->state)) && state - 1 < oldest)
+			oldest = state - 1;
+	for (i = 0; i < store->nb_retired; i++) {
+		if (store->retired[i].epoch >= oldest)
+			store->retired[kept++] = store->retired[i];
+		else if (store->retired[i].type == RETIRED_OH)
+			free_oh(store->retired[i].ptr);
+		else
+			_oh_free(store->retired[i].ptr);
+	}
+	store->nb_retired = kept;
+}
+
+/* Doubles the number of buckets. Entries are copied, as readers may still walk the old chains. */
+static void grow(oh_store *store) {
+	store_table *old = store->table,
+		    *table = new_table((old->mask + 1) * 2);
+	store_entry *entry, *copy;
+	size_t i;
+
+	for (i = 0; i <= old->mask; i++) {
+		for (entry = old->buckets[i]; entry; entry = entry->next) {
+			copy = calloc_or_die(NULL, 1, sizeof(*copy), "oh_store");
+			copy->id = entry->id;
+			copy->oh = entry->oh;
+			copy->next = table->buckets[HASH(entry->id, table->mask)];
+			table->buckets[HASH(entry->id, table->mask)] = copy;
+			retire(store, RETIRED_ENTRY, entry);
+		}
+	}
+	STORE(store->table, table);
+	retire(store, RETIRED_TABLE, old);
+}
+
+/*
+ * Stores oh for id, which the store then owns. The schedule it replaces
+ * is freed once no reader can use it anymore.
+ * Returns 1 if a schedule was replaced, 0 if id is new, -1 if oh is NULL.
+ */
+int oh_store_put(oh_store *store, unsigned long long id, opening_hours oh) {
+	store_entry *entry, **bucket;
+	int replaced = 0;
+
+	if (!oh)
+		return (-1);
+	pthread_mutex_lock(&store->write_lock);
+	if ((entry = find_entry(store->table, id))) {
+		retire(store, RETIRED_OH, entry->oh);
+		STORE(entry->oh, oh);
+		replaced = 1;
+	} else {
+		if (store->size >= (store->table->mask + 1) * 2)
+			grow(store);
+		entry = calloc_or_die(NULL, 1, sizeof(*entry), "oh_store");
+		entry->id = id;
+		entry->oh = oh;
+		bucket = &store->table->buckets[HASH(id, store->table->mask)];
+		entry->next = *bucket;
+		STORE(*bucket, entry);
+		STORE(store->size, store->size + 1);
+	}
+	collect(store);
+	pthread_mutex_unlock(&store->write_lock);
+	return (replaced);
+}
+
+/* Removes the schedule stored for id. Returns 1 if there was one, 0 otherwise. */
+int oh_store_remove(oh_store *store, unsigned long long id) {
+	store_entry *entry, **link;
+	int removed = 0;
+
+	pthread_mutex_lock(&store->write_lock);
+	link = &store->table->buckets[HASH(id, store->table->mask)];
+	for (; (entry = *link); link = &entry->next) {
+		if (entry->id == id) {
+			STORE(*link, entry->next);
+			retire(store, RETIRED_OH, entry->oh);
+			retire(store, RETIRED_ENTRY, entry);
+			STORE(store->size, store->size - 1);
+			removed = 1;
+			break;
+		}
+	}
+	collect(store);
+	pthread_mutex_unlock(&store->write_lock);
+	return (removed);
+}
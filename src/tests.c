@@ -1,9 +1,13 @@
+#define _POSIX_C_SOURCE 200809L
 #include <CUnit/CUnit.h>
 #include <CUnit/Basic.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "opening_hours.h"
+#include "parsing.h"
+#include "bitset_kernels.h"
 
 #define ADD_TEST(test) CU_add_test(suite, #test, test)
 
@@ -43,67 +47,697 @@ struct open_params {
 	(!(opt & EXACT_MATCH) || _res) && !strncmp(_fd_content, str, _len); \
 })
 
+/* Whether s builds, for output_match(), without keeping the object. */
+bool parses(char *s) {
+	opening_hours oh = build_opening_hours(s);
+	bool built = oh != NULL;
+
+	free_oh(oh);
+	return (built);
+}
+
 void write_toto(char *s) {
 	write(1, s, strlen(s));
 }
 
 void wide_ranges(void) {
-	CU_ASSERT(output_match(build_opening_hours, "off", standard_output, BEGIN_WITH, "ok"));
-	CU_ASSERT(output_match(build_opening_hours, "2016 Mar: off", standard_output, BEGIN_WITH, "ok"));
-	CU_ASSERT(output_match(build_opening_hours, "2016 Mar off", standard_output, BEGIN_WITH, "ok"));
-	CU_ASSERT(output_match(build_opening_hours, "2016 Mar 06 off", standard_output, BEGIN_WITH, "ok"));
-	CU_ASSERT(output_match(build_opening_hours, "Mar 06-Jan 19 off", standard_output, BEGIN_WITH, "ok"));
-	CU_ASSERT(output_match(build_opening_hours, "Mar 06-Jan 19 off", standard_output, BEGIN_WITH, "ok"));
-	CU_ASSERT(output_match(build_opening_hours, "Mar 06-Jan 19: closed", standard_output, BEGIN_WITH, "ok"));
-	CU_ASSERT(output_match(build_opening_hours, "Jan 06-Jan 19: closed", standard_output, BEGIN_WITH, "ok"));
-	CU_ASSERT(output_match(build_opening_hours, "Jan-Feb: closed", standard_output, BEGIN_WITH, "ok"));
-	CU_ASSERT(output_match(build_opening_hours, "2016 Feb 29", standard_output, BEGIN_WITH, "ok"));
+	CU_ASSERT(output_match(parses, "off", standard_output, BEGIN_WITH, "ok"));
+	CU_ASSERT(output_match(parses, "2016 Mar: off", standard_output, BEGIN_WITH, "ok"));
+	CU_ASSERT(output_match(parses, "2016 Mar off", standard_output, BEGIN_WITH, "ok"));
+	CU_ASSERT(output_match(parses, "2016 Mar 06 off", standard_output, BEGIN_WITH, "ok"));
+	CU_ASSERT(output_match(parses, "Mar 06-Jan 19 off", standard_output, BEGIN_WITH, "ok"));
+	CU_ASSERT(output_match(parses, "Mar 06-Jan 19 off", standard_output, BEGIN_WITH, "ok"));
+	CU_ASSERT(output_match(parses, "Mar 06-Jan 19: closed", standard_output, BEGIN_WITH, "ok"));
+	CU_ASSERT(output_match(parses, "Jan 06-Jan 19: closed", standard_output, BEGIN_WITH, "ok"));
+	CU_ASSERT(output_match(parses, "Jan-Feb: closed", standard_output, BEGIN_WITH, "ok"));
+	CU_ASSERT(output_match(parses, "2016 Feb 29", standard_output, BEGIN_WITH, "ok"));
 }
 
 void small_ranges(void) {
-	CU_ASSERT(output_match(build_opening_hours, "Tu-Sa 09:00-12:00,14:00-18:00", standard_output, BEGIN_WITH, "ok"));
+	CU_ASSERT(output_match(parses, "Tu-Sa 09:00-12:00,14:00-18:00", standard_output, BEGIN_WITH, "ok"));
 }
 
 void wide_and_small_ranges(void) {
-	CU_ASSERT(output_match(build_opening_hours, "2016 Feb 29: Tu -Mo", standard_output, BEGIN_WITH, "ok"));
-	CU_ASSERT(output_match(build_opening_hours, "2016 Tu-Sa 09:00-12:00,14:00-18:00", standard_output, BEGIN_WITH, "ok"));
-	CU_ASSERT(output_match(build_opening_hours, "2016: Tu-Sa 09:00-12:00,14:00-18:00", standard_output, BEGIN_WITH, "ok"));
-	CU_ASSERT(output_match(build_opening_hours, "Mar: Tu-Sa 09:00-12:00,14:00-18:00", standard_output, BEGIN_WITH, "ok"));
-	CU_ASSERT(output_match(build_opening_hours, "Mar-Apr: Tu-Sa 09:00-12:00,14:00-18:00", standard_output, BEGIN_WITH, "ok"));
+	CU_ASSERT(output_match(parses, "2016 Feb 29: Tu -Mo", standard_output, BEGIN_WITH, "ok"));
+	CU_ASSERT(output_match(parses, "2016 Tu-Sa 09:00-12:00,14:00-18:00", standard_output, BEGIN_WITH, "ok"));
+	CU_ASSERT(output_match(parses, "2016: Tu-Sa 09:00-12:00,14:00-18:00", standard_output, BEGIN_WITH, "ok"));
+	CU_ASSERT(output_match(parses, "Mar: Tu-Sa 09:00-12:00,14:00-18:00", standard_output, BEGIN_WITH, "ok"));
+	CU_ASSERT(output_match(parses, "Mar-Apr: Tu-Sa 09:00-12:00,14:00-18:00", standard_output, BEGIN_WITH, "ok"));
 }
 
 void syntax_errors(void)
 {
-	CU_ASSERT(output_match(build_opening_hours, "toto", standard_output, BEGIN_WITH, "Invalid syntax: "));
-	CU_ASSERT(output_match(build_opening_hours, ":", standard_output, BEGIN_WITH, "Invalid syntax: "));
-	CU_ASSERT(output_match(build_opening_hours, "\"comment\"", standard_output, BEGIN_WITH, "Invalid syntax: missing colon"));
-	CU_ASSERT(output_match(build_opening_hours, "\"\":", standard_output, BEGIN_WITH, "Invalid syntax: empty comment"));
-	CU_ASSERT(output_match(build_opening_hours, "1800", standard_output, BEGIN_WITH, "Invalid range:"));
-	CU_ASSERT(output_match(build_opening_hours, "3800", standard_output, BEGIN_WITH, "Invalid range:"));
-	CU_ASSERT(output_match(build_opening_hours, "2016 Feb 30", standard_output, BEGIN_WITH, "Invalid range:"));
-	CU_ASSERT(output_match(build_opening_hours, "2016 Feb 29: Tu -Ma", standard_output, BEGIN_WITH, "Invalid range:"));
-	CU_ASSERT(output_match(build_opening_hours, "2016 Feb 29: Ta -Mo", standard_output, BEGIN_WITH, "Invalid syntax:"));
-}
-
-int open(open_params params) {
+	CU_ASSERT(output_match(parses, "toto", standard_output, BEGIN_WITH, "Invalid syntax: "));
+	CU_ASSERT(output_match(parses, ":", standard_output, BEGIN_WITH, "Invalid syntax: "));
+	CU_ASSERT(output_match(parses, "\"comment\"", standard_output, BEGIN_WITH, "Invalid syntax: missing colon"));
+	CU_ASSERT(output_match(parses, "\"\":", standard_output, BEGIN_WITH, "Invalid syntax: empty comment"));
+	CU_ASSERT(output_match(parses, "1800", standard_output, BEGIN_WITH, "Invalid range:"));
+	CU_ASSERT(output_match(parses, "3800", standard_output, BEGIN_WITH, "Invalid range:"));
+	CU_ASSERT(output_match(parses, "2016 Feb 30", standard_output, BEGIN_WITH, "Invalid range:"));
+	CU_ASSERT(output_match(parses, "2016 Feb 29: Tu -Ma", standard_output, BEGIN_WITH, "Invalid range:"));
+	CU_ASSERT(output_match(parses, "2016 Feb 29: Ta -Mo", standard_output, BEGIN_WITH, "Invalid syntax:"));
+}
+
+int check_open(open_params params) {
 	int pipes[2];
-	int last_fd = dup(1);
+	int last_fd = dup(1), res;
 
 	pipe(pipes);
 	dup2(pipes[1], 1);
 	opening_hours oh = build_opening_hours(params.oh);
 	close(pipes[0]);
 	dup2(last_fd, 1);
-	return (is_open_time(oh, params.date));
+	res = is_open_time(oh, params.date);
+	free_oh(oh);
+	return (res);
 }
 
 void opening_tests(void) {
-	CU_ASSERT(open((open_params){"2016 Mar-Dec: Mo-Fr 09:00-19:00", (struct tm){.tm_min = 24, .tm_hour = 12, .tm_mday = 21, .tm_wday = 3, .tm_year = 2016 - 1900, .tm_mon = 6}}));
-	CU_ASSERT(open((open_params){"2016 Mar-Dec: Mo-Fr 09:00-19:00", (struct tm){.tm_min = 24, .tm_hour = 12, .tm_mday = 21, .tm_wday = 3, .tm_year = 2016 - 1900, .tm_mon = 6}}));
-	CU_ASSERT(!open((open_params){"2016 Mar-Dec: Mo-Fr 14:00-19:00", (struct tm){.tm_min = 24, .tm_hour = 12, .tm_mday = 21, .tm_wday = 3, .tm_year = 2016 - 1900, .tm_mon = 6}}));
-	CU_ASSERT(!open((open_params){"2016 Mar-Dec: Mo-Fr 09:00-19:00", (struct tm){.tm_min = 24, .tm_hour = 12, .tm_mday = 21, .tm_wday = 3, .tm_year = 2015 - 1900, .tm_mon = 6}}));
-	CU_ASSERT(!open((open_params){"2016 Mar-Dec: Mo-Fr 09:00-19:00", (struct tm){.tm_min = 24, .tm_hour = 20, .tm_mday = 21, .tm_wday = 3, .tm_year = 2015 - 1900, .tm_mon = 6}}));
-	CU_ASSERT(!open((open_params){"2016 Mar-Dec: Mo-Fr 09:00-19:00", (struct tm){.tm_min = 24, .tm_hour = 12, .tm_mday = 21, .tm_wday = 3, .tm_year = 2016 - 1900, .tm_mon = 0}}));
+	CU_ASSERT(check_open((open_params){"2016 Mar-Dec: Mo-Fr 09:00-19:00", (struct tm){.tm_min = 24, .tm_hour = 12, .tm_mday = 21, .tm_wday = 3, .tm_year = 2016 - 1900, .tm_mon = 6}}));
+	CU_ASSERT(check_open((open_params){"2016 Mar-Dec: Mo-Fr 09:00-19:00", (struct tm){.tm_min = 24, .tm_hour = 12, .tm_mday = 21, .tm_wday = 3, .tm_year = 2016 - 1900, .tm_mon = 6}}));
+	CU_ASSERT(!check_open((open_params){"2016 Mar-Dec: Mo-Fr 14:00-19:00", (struct tm){.tm_min = 24, .tm_hour = 12, .tm_mday = 21, .tm_wday = 3, .tm_year = 2016 - 1900, .tm_mon = 6}}));
+	CU_ASSERT(!check_open((open_params){"2016 Mar-Dec: Mo-Fr 09:00-19:00", (struct tm){.tm_min = 24, .tm_hour = 12, .tm_mday = 21, .tm_wday = 3, .tm_year = 2015 - 1900, .tm_mon = 6}}));
+	CU_ASSERT(!check_open((open_params){"2016 Mar-Dec: Mo-Fr 09:00-19:00", (struct tm){.tm_min = 24, .tm_hour = 20, .tm_mday = 21, .tm_wday = 3, .tm_year = 2015 - 1900, .tm_mon = 6}}));
+	CU_ASSERT(!check_open((open_params){"2016 Mar-Dec: Mo-Fr 09:00-19:00", (struct tm){.tm_min = 24, .tm_hour = 12, .tm_mday = 21, .tm_wday = 3, .tm_year = 2016 - 1900, .tm_mon = 0}}));
+	CU_ASSERT(check_open((open_params){"Su 10:00-12:00", (struct tm){.tm_min = 0, .tm_hour = 11, .tm_mday = 24, .tm_wday = 0, .tm_year = 2016 - 1900, .tm_mon = 6}}));
+	CU_ASSERT(!check_open((open_params){"Mo 10:00-12:00", (struct tm){.tm_min = 0, .tm_hour = 11, .tm_mday = 24, .tm_wday = 0, .tm_year = 2016 - 1900, .tm_mon = 6}}));
+	CU_ASSERT(check_open((open_params){"Sa 22:00-26:00", (struct tm){.tm_min = 0, .tm_hour = 1, .tm_mday = 24, .tm_wday = 0, .tm_year = 2016 - 1900, .tm_mon = 6}}));
+	CU_ASSERT(check_open((open_params){"Sa 22:00-26:00", (struct tm){.tm_min = 59, .tm_hour = 1, .tm_mday = 24, .tm_wday = 0, .tm_year = 2016 - 1900, .tm_mon = 6}}));
+	CU_ASSERT(!check_open((open_params){"Sa 22:00-26:00", (struct tm){.tm_min = 0, .tm_hour = 2, .tm_mday = 24, .tm_wday = 0, .tm_year = 2016 - 1900, .tm_mon = 6}}));
+}
+
+void memory_usage(void) {
+	oh_memory_stats stats;
+	opening_hours oh = build_opening_hours("Mo-Fr 09:00-18:00");
+
+	CU_ASSERT(oh_memory_usage(oh, &stats));
+	CU_ASSERT(stats.nb_rules == 1);
+	CU_ASSERT(stats.years_bytes == 0 && stats.monthdays_bytes == 0 && stats.weeks_bytes == 0);
+	/* Pooled hours, owned by this rule alone, count with the header of their node. */
+	CU_ASSERT(stats.hours_bytes == bitset_allocated_bytes(oh->rule.selector.small_range.hours.time_range, 1));
+	CU_ASSERT(stats.hours_bytes > BITSET_NBYTES(oh->rule.selector.small_range.hours.time_range));
+	CU_ASSERT(stats.nb_allocations == 3);
+	CU_ASSERT(stats.shared_bytes == BITSET_NBYTES(oh->rule.selector.wide_range.years)
+			+ BITSET_NBYTES(oh->rule.selector.wide_range.monthdays.days)
+			+ BITSET_NBYTES(oh->rule.selector.wide_range.weeks)
+			+ BITSET_NBYTES(oh->rule.selector.small_range.hours.extended_time_range));
+	CU_ASSERT(stats.total_bytes == stats.rules_bytes + stats.years_bytes + stats.monthdays_bytes
+			+ stats.weeks_bytes + stats.weekdays_bytes + stats.hours_bytes);
+	free_oh(oh);
+	oh = build_opening_hours("2016 Dec 25 off; Dec week 52 Sa 22:00-26:00");
+	CU_ASSERT(oh_memory_usage(oh, &stats));
+	CU_ASSERT(stats.nb_allocations == 3 + 6);    /* rule, years, monthdays; rule, monthdays, weeks, weekdays, 2 hours */
+	CU_ASSERT(stats.shared_bytes == BITSET_NBYTES(oh->rule.selector.wide_range.weeks)
+			+ BITSET_NBYTES(oh->rule.selector.small_range.weekday.range)
+			+ BITSET_NBYTES(oh->rule.selector.small_range.hours.time_range)
+			+ BITSET_NBYTES(oh->rule.selector.small_range.hours.extended_time_range)
+			+ BITSET_NBYTES(oh->next_item->rule.selector.wide_range.years));
+	CU_ASSERT(is_open_expended(oh, 0, 1, 25, 11, 116, 0) == 0);
+	CU_ASSERT(is_open_expended(oh, 0, 1, 31, 11, 117, 0) == 1);
+	free_oh(oh);
+	CU_ASSERT(!oh_memory_usage(NULL, &stats) && !stats.total_bytes);
+}
+
+void hot_path_counters(void) {
+	oh_counters before, built, after;
+	int instrumented = oh_counters_snapshot(&before);
+	opening_hours oh = build_opening_hours("Mo 10:00-12:00");
+
+	oh_counters_snapshot(&built);
+	is_open_expended(oh, 0, 11, 1, 0, 116, 0);
+	oh_counters_snapshot(&after);
+	if (instrumented) {
+		CU_ASSERT(built.parses == before.parses + 1);
+		CU_ASSERT(built.bitset_bytes - before.bitset_bytes == 32 + 208);
+		CU_ASSERT(built.regex_compilations > before.regex_compilations);
+		CU_ASSERT(after.is_open_calls == built.is_open_calls + 1);
+		CU_ASSERT(after.rules_scanned == built.rules_scanned + 1);
+		CU_ASSERT(after.bitset_probes > built.bitset_probes);
+	} else {
+		CU_ASSERT(!after.is_open_calls && !after.parses);
+	}
+	free_oh(oh);
+}
+
+static opening_hours edit_target;
+static char edit_source[] = "Mo 10:00-12:00; Tu 10:00-12:00; We 10:00-12:00; Th 10:00-12:00";
+
+opening_hours edit_tuesday(char *new_s) {
+	return (edit_opening_hours(edit_target, edit_source, 26, 27, new_s));
+}
+
+void incremental_edit(void) {
+	char new_s[] = "Mo 10:00-12:00; Tu 10:00-18:00; We 10:00-12:00; Th 10:00-12:00";
+	opening_hours oh = (edit_target = build_opening_hours(edit_source)),
+		      fresh = build_opening_hours(new_s),
+		      third = oh->next_item->next_item,
+		      last = third->next_item;
+
+	CU_ASSERT(output_match(edit_tuesday, "Mo 10:00-12:00; Tu 10:00-1a:00; We 10:00-12:00; Th 10:00-12:00", standard_output, BEGIN_WITH, "Invalid syntax:"));
+	CU_ASSERT(edit_tuesday(new_s) == oh);
+	CU_ASSERT(oh->next_item->next_item == third && third->next_item == last);
+	CU_ASSERT(!strcmp(print_oh(oh), print_oh(fresh)));
+	CU_ASSERT(is_open_expended(oh, 0, 15, 19, 6, 116, 2) && !is_open_expended(oh, 0, 15, 20, 6, 116, 3));
+	CU_ASSERT(!edit_opening_hours(oh, new_s, 26, sizeof(new_s), new_s));
+	CU_ASSERT(!edit_opening_hours(oh, new_s, 26, 27, "Mo 10:00-12:00"));
+	CU_ASSERT(!edit_opening_hours(oh, NULL, 0, 0, new_s));
+	CU_ASSERT(oh->next_item->next_item == third && !strcmp(print_oh(oh), print_oh(fresh)));
+	free_oh(fresh);
+	free_oh(oh);
+}
+
+void set_algebra(void) {
+	opening_hours a = build_opening_hours("Mo-Fr 09:00-18:00"),
+		      b = build_opening_hours("Tu-Sa 12:00-20:00"),
+		      both = oh_intersection(a, b),
+		      either = oh_union(a, b),
+		      only_a = oh_difference(a, b),
+		      none = oh_difference(a, a);
+
+	/* Mon 18, Tue 19 and Sat 23 July 2016 */
+	CU_ASSERT(!is_open_expended(both, 0, 10, 18, 6, 116, 1) && is_open_expended(both, 0, 13, 19, 6, 116, 2));
+	CU_ASSERT(!is_open_expended(both, 0, 19, 19, 6, 116, 2) && !is_open_expended(both, 0, 13, 23, 6, 116, 6));
+	CU_ASSERT(is_open_expended(either, 0, 10, 18, 6, 116, 1) && is_open_expended(either, 0, 19, 19, 6, 116, 2));
+	CU_ASSERT(is_open_expended(either, 0, 13, 23, 6, 116, 6) && !is_open_expended(either, 0, 21, 19, 6, 116, 2));
+	CU_ASSERT(is_open_expended(only_a, 0, 13, 18, 6, 116, 1) && is_open_expended(only_a, 0, 10, 19, 6, 116, 2));
+	CU_ASSERT(!is_open_expended(only_a, 0, 13, 19, 6, 116, 2) && !is_open_expended(none, 0, 13, 18, 6, 116, 1));
+	CU_ASSERT(none && none->rule.state.type == RULE_CLOSED && !none->next_item);
+	CU_ASSERT(!oh_union(a, NULL));
+	free_oh(a);
+	free_oh(b);
+	free_oh(both);
+	free_oh(either);
+	free_oh(only_a);
+	free_oh(none);
+}
+
+void bitset_kernels(void) {
+	char *names[] = {"scalar", "sse2", "avx2", "avx512"};
+	bitset a = Bitset(1440), b = Bitset(1024), c;
+	size_t i;
+
+	set_subset(a, 3, 1000, true);
+	set_subset(b, 500, 1023, true);
+	for (i = 0; i < sizeof(names) / sizeof(*names); i++) {
+		if (!bitset_select_kernels(names[i]))
+			continue;
+		c = bitwise_xor(a, b);
+		CU_ASSERT(BITSET_SIZE(c) == 1440 && bitset_count(c) == 497 + 23);
+		CU_ASSERT(GET_BIT(c, 499) && !GET_BIT(c, 500) && !GET_BIT(c, 1000) && GET_BIT(c, 1023) && !GET_BIT(c, 1024));
+		bitwise_nor_to(c, a, b);
+		CU_ASSERT(bitset_count(c) == 3 + 416 && GET_BIT(c, 1024) && !GET_BIT(c, 1023));
+		bitwise_xnor_to(c, c, c);
+		CU_ASSERT(bitset_count(c) == 1440 && !(c[11] >> (1440 % 128)));
+		set_subset(c, 1, 1438, false);
+		CU_ASSERT(bitset_count(c) == 2 && !compare_bitsets(a, c));
+		bitwise_and_to(c, a, a);
+		CU_ASSERT(compare_bitsets(a, c) && !compare_bitsets(a, b));
+		del_bitset(c);
+	}
+	CU_ASSERT(!bitset_select_kernels("mmx") && bitset_select_kernels(NULL));
+	del_bitset(a);
+	del_bitset(b);
+}
+
+void bitset_scanning(void) {
+	bitset set = Bitset(1440);
+	size_t starts[4], ends[4], start, end, nb_runs = 0;
+
+	CU_ASSERT(bitset_next_set(set, 0) == 1440 && bitset_next_clear(set, 0) == 0);
+	set_subset(set, 100, 300, true);
+	set_subset(set, 1300, 1439, true);
+	SET_BIT(set, 640, true);
+	CU_ASSERT(bitset_next_set(set, 0) == 100 && bitset_next_set(set, 301) == 640 && bitset_next_set(set, 641) == 1300);
+	CU_ASSERT(bitset_next_clear(set, 100) == 301 && bitset_next_clear(set, 1300) == 1440);
+	CU_ASSERT(bitset_next_set(set, 1440) == 1440 && bitset_next_clear(set, 1440) == 1440);
+	bitset_runs(set, 0, 1440, start, end) {
+		starts[nb_runs] = start;
+		ends[nb_runs++] = end;
+	}
+	CU_ASSERT(nb_runs == 3 && starts[0] == 100 && ends[0] == 301 && starts[1] == 640 && ends[1] == 641);
+	CU_ASSERT(starts[2] == 1300 && ends[2] == 1440);
+	nb_runs = 0;
+	bitset_runs(set, 200, 1350, start, end)
+		starts[nb_runs++] = start;
+	CU_ASSERT(nb_runs == 3 && starts[0] == 200 && end == 1350);
+	del_bitset(set);
+}
+
+void open_minutes(void) {
+	opening_hours ohs[3] = {build_opening_hours("Mo-Fr 09:00-18:00"), build_opening_hours("Sa 22:00-26:00"), NULL};
+	time_t monday = 1468800000;    /* 2016-07-18 00:00 UTC */
+	long minutes[3];
+
+	CU_ASSERT(oh_open_minutes(ohs[0], monday, monday + 7 * 86400) == 5 * 9 * 60);
+	CU_ASSERT(oh_open_minutes(ohs[0], monday + 10 * 3600 + 1800, monday + 12 * 3600) == 90);
+	CU_ASSERT(oh_open_minutes(ohs[0], monday + 12 * 3600, monday) == 0);
+	oh_open_minutes_many(ohs, 3, monday - 86400, monday + 86400, minutes);
+	CU_ASSERT(minutes[0] == 9 * 60 && minutes[1] == 2 * 60 && minutes[2] == 0);
+	free_oh(ohs[0]);
+	free_oh(ohs[1]);
+}
+
+void fingerprints(void) {
+	opening_hours a = build_opening_hours("Mo-Fr 9:00-18:00"),
+		      b = build_opening_hours("Mo,Tu,We,Th,Fr 09:00-18:00"),
+		      c = build_opening_hours("Mo-Fr 09:00-12:00,12:00-18:00; Sa 10:00-12:00 off"),
+		      d = build_opening_hours("Mo-Fr 09:00-18:01");
+	oh_fingerprint fa, fb;
+
+	CU_ASSERT(oh_fingerprint128(a, &fa) && oh_fingerprint128(b, &fb));
+	CU_ASSERT(fa.lo == fb.lo && fa.hi == fb.hi && oh_fingerprint64(a) == fa.lo);
+	CU_ASSERT(oh_fingerprint64(c) == fa.lo && oh_fingerprint64(d) != fa.lo);
+	CU_ASSERT(oh_equivalent(a, b) && oh_equivalent(a, c) && !oh_equivalent(a, d) && !oh_equivalent(a, NULL));
+	CU_ASSERT(!oh_fingerprint128(NULL, &fa));
+	free_oh(a);
+	free_oh(b);
+	free_oh(c);
+	free_oh(d);
+}
+
+void window_queries(void) {
+	opening_hours shop = build_opening_hours("Mo-Fr 09:00-18:00"),
+		      always = build_opening_hours("2016 Dec 25 off; Mo-Su 00:00-24:00"),
+		      summer = build_opening_hours("Dec 01-Dec 31 off; Aug 10-Aug 12 off; Mo-Su 00:00-24:00");
+	time_t monday = 1468800000;    /* 2016-07-18 00:00 UTC */
+
+	CU_ASSERT(oh_open_throughout(shop, monday + 9 * 3600, monday + 18 * 3600));
+	CU_ASSERT(!oh_open_throughout(shop, monday + 9 * 3600, monday + 18 * 3600 + 60));
+	CU_ASSERT(oh_open_any(shop, monday + 17 * 3600, monday + 20 * 3600));
+	CU_ASSERT(!oh_open_any(shop, monday + 5 * 86400, monday + 7 * 86400));
+	CU_ASSERT(!oh_open_any(shop, monday + 10 * 3600, monday + 10 * 3600));
+	CU_ASSERT(oh_open_throughout(always, monday, monday + 150 * 86400));
+	CU_ASSERT(!oh_open_throughout(always, monday, monday + 200 * 86400));
+	/* A later rule closing earlier than the first one still ends the run. */
+	CU_ASSERT(oh_open_throughout(summer, monday, monday + 23 * 86400));
+	CU_ASSERT(!oh_open_throughout(summer, monday, monday + 23 * 86400 + 60));
+	CU_ASSERT(oh_open_throughout(summer, monday + 25 * 86400, monday + 136 * 86400));
+	CU_ASSERT(!oh_open_throughout(summer, monday + 25 * 86400, monday + 136 * 86400 + 60));
+	CU_ASSERT(!oh_open_any(summer, monday + 23 * 86400, monday + 25 * 86400));
+	free_oh(shop);
+	free_oh(always);
+	free_oh(summer);
+}
+
+void open_slots(void) {
+	opening_hours shop = build_opening_hours("Mo-Fr 09:00-18:00"),
+		      night = build_opening_hours("Fr 22:00-26:00; Sa 02:00-05:00"),
+		      christmas = build_opening_hours("Dec 24 10:00-14:00"),
+		      always = build_opening_hours("Mo-Su 00:00-24:00");
+	time_t monday = 1468800000, start = 0;    /* 2016-07-18 00:00 UTC */
+
+	CU_ASSERT(oh_find_slot(shop, monday + 8 * 3600, 45, 7 * 1440, &start) && start == monday + 9 * 3600);
+	CU_ASSERT(oh_find_slot(shop, monday + 17 * 3600 + 30 * 60, 45, 7 * 1440, &start) && start == monday + 33 * 3600);
+	CU_ASSERT(oh_find_slot(shop, monday + 10 * 3600 + 30, 60, 7 * 1440, &start) && start == monday + 10 * 3600 + 60);
+	CU_ASSERT(!oh_find_slot(shop, monday, 10 * 60, 7 * 1440, &start));
+	CU_ASSERT(!oh_find_slot(shop, monday + 17 * 3600, 45, 40, &start));
+	CU_ASSERT(oh_find_slot(night, monday, 7 * 60, 7 * 1440, &start) && start == monday + 4 * 86400 + 22 * 3600);
+	CU_ASSERT(!oh_find_slot(night, monday, 7 * 60 + 1, 14 * 1440, &start));
+	CU_ASSERT(oh_find_slot(christmas, monday, 4 * 60, 200 * 1440, &start) && start == 1482573600);
+	CU_ASSERT(oh_find_slot(always, monday + 90, 10 * 1440, 11 * 1440, &start) && start == monday + 120);
+	CU_ASSERT(!oh_find_slot(always, monday, 0, 1440, &start) && !oh_find_slot(NULL, monday, 1, 1440, &start));
+	free_oh(shop);
+	free_oh(night);
+	free_oh(christmas);
+	free_oh(always);
+}
+
+void open_histogram(void) {
+	opening_hours ohs[400] = {NULL};
+	time_t monday = 1468800000;    /* 2016-07-18 00:00 UTC */
+	size_t counts[OH_WEEK_MINUTES], total = 0, i;
+
+	for (i = 0; i < 400; i += 4) {
+		ohs[i] = build_opening_hours("Mo-Fr 09:00-18:00");
+		ohs[i + 1] = build_opening_hours("Fr 22:00-26:00");
+		ohs[i + 2] = build_opening_hours("Mo-Su 00:00-24:00");
+	}
+	oh_open_histogram(ohs, 400, monday, counts, 2);
+	for (i = 0; i < OH_WEEK_MINUTES; i++)
+		total += counts[i];
+	CU_ASSERT(total == 100 * (OH_WEEK_MINUTES + 5 * 540 + 240));
+	CU_ASSERT(counts[0] == 100 && counts[9 * 60] == 200 && counts[18 * 60] == 100);
+	CU_ASSERT(counts[4 * 1440 + 23 * 60] == 200 && counts[5 * 1440 + 60] == 200 && counts[5 * 1440 + 120] == 100);
+	oh_open_histogram(ohs, 400, monday + 9 * 3600 - 30, counts, 0);
+	CU_ASSERT(counts[0] == 200 && counts[540] == 100 && counts[OH_WEEK_MINUTES - 1] == 100);
+	for (i = 0; i < 400; i++)
+		free_oh(ohs[i]);
+}
+
+void object_store(void) {
+	oh_store *store = oh_store_new(0);
+	when monday = {{{0, 10, 18, 6, 116, 1}}}, sunday = {{{0, 10, 24, 6, 116, 0}}};
+	unsigned long long id;
+
+	CU_ASSERT(oh_store_put(store, 42, build_opening_hours("Mo-Fr 09:00-18:00")) == 0);
+	CU_ASSERT(oh_store_is_open(store, 42, monday) == 1);
+	CU_ASSERT(oh_store_is_open(store, 42, sunday) == 0);
+	CU_ASSERT(oh_store_is_open(store, 7, monday) == -1);
+	CU_ASSERT(oh_store_put(store, 42, build_opening_hours("Su 09:00-18:00")) == 1);
+	CU_ASSERT(oh_store_is_open(store, 42, sunday) == 1);
+	CU_ASSERT(oh_store_put(store, 7, NULL) == -1);
+	for (id = 1000; id < 1500; id++)
+		oh_store_put(store, id, build_opening_hours("Mo 10:00-11:00"));
+	CU_ASSERT(oh_store_size(store) == 501);
+	oh_store_read_begin(store);
+	CU_ASSERT(oh_store_get(store, 1234) != NULL);
+	CU_ASSERT(oh_store_get(store, 1500) == NULL);
+	oh_store_read_end(store);
+	CU_ASSERT(oh_store_remove(store, 42) == 1);
+	CU_ASSERT(oh_store_remove(store, 42) == 0);
+	CU_ASSERT(oh_store_is_open(store, 42, sunday) == -1);
+	CU_ASSERT(oh_store_is_open(store, 1499, monday) == 1);
+	CU_ASSERT(oh_store_size(store) == 500);
+	oh_store_free(store);
+}
+
+void validation(void) {
+	oh_counters before, after;
+	int instrumented = oh_counters_snapshot(&before);
+	char *s = "Mo-Fr 09:00-18:00; Sa 12:00-10:00";
+	oh_error err;
+
+	CU_ASSERT(oh_validate("Mo-Fr 09:00-18:00", 17, &err) == 1);
+	CU_ASSERT(err.offset == 0 && !err.message[0]);
+	CU_ASSERT(oh_validate("Mo 25:00-26:00", 14, &err) == 0);
+	CU_ASSERT(err.offset == 3);
+	CU_ASSERT(!strcmp(err.message, "Invalid range: are you really sure that such an hour does exist?"));
+	CU_ASSERT(oh_validate(s, strlen(s), &err) == 0);
+	CU_ASSERT(err.offset == 28);
+	CU_ASSERT(!strchr(err.message, '\n'));
+	CU_ASSERT(oh_validate(s, 17, NULL) == 1);
+	CU_ASSERT(oh_validate("Mo 10:00\0-12:00", 14, &err) == 0 && err.offset == 8);
+	CU_ASSERT(oh_validate(NULL, 0, &err) == 0);
+	oh_counters_snapshot(&after);
+	if (instrumented)
+		CU_ASSERT(after.bitset_bytes == before.bitset_bytes);
+}
+
+void specialized_evaluators(void) {
+	char *sources[] = {"Mo-Fr 09:00-18:00", "10:00-18:00", "24/7 ", "Jan-Mar Mo 10:00-12:00", "Sa 22:00-26:00",
+		"2016 Dec 25 off; Mo-Su 00:00-24:00", "\"by appointment\": Mo 10:00-12:00", "Dec week 52 Sa 22:00-26:00"};
+	opening_hours oh, other;
+	oh_evaluator evaluate;
+	int mismatches = 0;
+	size_t i;
+	when date;
+
+	for (i = 0; i < sizeof(sources) / sizeof(*sources); i++) {
+		oh = build_opening_hours(sources[i]);
+		CU_ASSERT(oh->evaluate != NULL);
+		evaluate = oh->evaluate;
+		for (date.tm_year = 115; date.tm_year < 118; date.tm_year++)
+			for (date.tm_mon = 0; date.tm_mon < 12; date.tm_mon += 2)
+				for (date.tm_mday = 1; date.tm_mday <= 31; date.tm_mday += 3)
+					for (date.tm_hour = 0; date.tm_hour < 24; date.tm_hour += 5) {
+						date.tm_wday = (date.tm_mday + date.tm_mon) % 7;
+						date.tm_min = date.tm_hour * 7 % 60;
+						oh->evaluate = evaluate;
+						mismatches += is_open(oh, date);
+						oh->evaluate = NULL;
+						mismatches -= is_open(oh, date);
+					}
+		free_oh(oh);
+	}
+	CU_ASSERT(!mismatches);
+	oh = build_opening_hours("\"by appointment\": Mo 10:00-12:00");
+	CU_ASSERT(is_open_expended(oh, 0, 11, 18, 6, 116, 1) && !is_open_expended(oh, 0, 11, 19, 6, 116, 2));
+	free_oh(oh);
+	oh = (edit_target = build_opening_hours(edit_source));
+	other = build_opening_hours("Mo 10:00-12:00; Tu 10:00-26:00; We 10:00-12:00; Th 10:00-12:00");
+	evaluate = oh->evaluate;
+	CU_ASSERT(edit_tuesday("Mo 10:00-12:00; Tu 10:00-26:00; We 10:00-12:00; Th 10:00-12:00") == oh);
+	CU_ASSERT(oh->evaluate == other->evaluate && oh->evaluate != evaluate);
+	free_oh(other);
+	free_oh(oh);
+}
+
+void out_of_range_years(void) {
+	opening_hours dated = build_opening_hours("2016 Mo-Su 00:00-24:00"),
+		      always = build_opening_hours("Mo-Su 00:00-24:00");
+	int years[] = {-1100, -1, 1024, 1100, 2000000000}, generic, i;
+	time_t year_3000 = 32503680000;    /* 3000-01-01 00:00 UTC */
+
+	for (generic = 0; generic < 2; generic++) {
+		for (i = 0; i < 5; i++) {
+			CU_ASSERT(!is_open_expended(dated, 0, 11, 18, 6, years[i], 1));
+			CU_ASSERT(is_open_expended(always, 0, 11, 18, 6, years[i], 1));
+		}
+		dated->evaluate = NULL;
+		always->evaluate = NULL;
+	}
+	CU_ASSERT(oh_open_minutes(dated, year_3000, year_3000 + 86400) == 0);
+	CU_ASSERT(oh_open_minutes(always, year_3000, year_3000 + 86400) == 1440);
+	free_oh(dated);
+	free_oh(always);
+}
+
+void calendar_conversion(void) {
+	long days[] = {17000, 18628, 17896, 17166, -1};
+	time_t seconds[] = {17000 * 86400L + 11 * 3600 + 30 * 60 + 59, -60};
+	int iso_weeks[5], year_days[5];
+	opening_hours oh = build_opening_hours("Mo 10:00-12:00");
+	when dates[5];
+
+	CU_ASSERT(oh_when_from_days(days, 5, dates, iso_weeks, year_days) == 1);
+	/* Mon 18 July 2016 */
+	CU_ASSERT(dates[0].tm_year == 116 && dates[0].tm_mon == 6 && dates[0].tm_mday == 18 && dates[0].tm_wday == 1);
+	CU_ASSERT(!dates[0].tm_hour && !dates[0].tm_min && iso_weeks[0] == 29 && year_days[0] == 199);
+	/* Fri 1 January 2021 is in the last week of 2020, Mon 31 December 2018 in the first of 2019. */
+	CU_ASSERT(iso_weeks[1] == 53 && year_days[1] == 0 && iso_weeks[2] == 1 && year_days[2] == 364);
+	CU_ASSERT(iso_weeks[3] == 52 && year_days[3] == 365);
+	CU_ASSERT(dates[4].tm_year == 69 && dates[4].tm_mon == 11 && dates[4].tm_mday == 31 && dates[4].tm_wday == 3);
+	CU_ASSERT(oh_when_from_seconds(seconds, 2, dates, NULL, NULL) == 1);
+	CU_ASSERT(dates[0].tm_hour == 11 && dates[0].tm_min == 30 && is_open(oh, dates[0]));
+	CU_ASSERT(dates[1].tm_year == 69 && dates[1].tm_mday == 31 && dates[1].tm_hour == 23 && dates[1].tm_min == 59);
+	days[0] = 2000000000L;
+	CU_ASSERT(oh_when_from_days(days, 1, dates, NULL, NULL) == 0);
+	free_oh(oh);
+}
+
+void osm_loading(void) {
+	char path[] = "/tmp/oh-test-XXXXXX";
+	char xml[] = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<osm version=\"0.6\">\n"
+		" <node id=\"42\" lat=\"1.0\" lon=\"2.0\">\n"
+		"  <tag k=\"name\" v=\"k=&quot;opening_hours&quot;\"/>\n"
+		"  <tag k=\"opening_hours\" v=\"&quot;by appointment&quot;: Mo 10:00-12:00\"/>\n"
+		" </node>\n"
+		" <way id='42'>\n  <nd ref='1'/>\n  <tag k='opening_hours' v='Sa 10:00-12:00'/>\n </way>\n"
+		" <relation id=\"7\">\n  <member type=\"way\" ref=\"42\" role=\"\"/>\n"
+		"  <tag k=\"opening_hours:kitchen\" v=\"Tu 10:00-12:00\"/>\n"
+		"  <tag k=\"opening_hours\" v=\"Mo 25:00-26:00\"/>\n </relation>\n"
+		" <way id=\"9\">\n  <tag k=\"opening_hours:delivery\" v=\"Mo 10:00-12:00\"/>\n"
+		"  <tag k=\"opening_hours:kitchen\" v=\"Tu 10:00-12:00\"/>\n  <tag k=\"opening_hours\" v=\"Sa 10:00-12:00\"/>\n </way>\n"
+		" <node id=\"-3\" lat=\"1.0\" lon=\"2.0\"/>\n"
+		" <tag k=\"opening_hours\" v=\"Mo 10:00-12:00\"/>\n"
+		"</osm>\n";
+	int fd = mkstemp(path);
+	oh_store *store = oh_store_new(0);
+	size_t invalid, duplicates;
+	/* Mon 18 and Sat 23 July 2016 */
+	when monday = {{{0, 11, 18, 6, 116, 1}}}, saturday = {{{0, 11, 23, 6, 116, 6}}};
+
+	CU_ASSERT(fd >= 0 && write(fd, xml, strlen(xml)) == (ssize_t) strlen(xml));
+	close(fd);
+	/* By default, opening_hours and its subkeys: an element keeps its valid opening_hours tag, or else its first one. */
+	CU_ASSERT(oh_store_load_osm(store, path, NULL, 2, &invalid, &duplicates) == 4 && invalid == 1 && duplicates == 2);
+	CU_ASSERT(oh_store_is_open(store, 42, monday) == 1 && oh_store_is_open(store, 42, saturday) == 0);
+	CU_ASSERT(oh_store_is_open(store, 42 | OH_OSM_WAY, saturday) == 1);
+	CU_ASSERT(oh_store_is_open(store, 7 | OH_OSM_RELATION, monday) == 0 && oh_store_size(store) == 4);
+	CU_ASSERT(oh_store_is_open(store, 9 | OH_OSM_WAY, saturday) == 1 && oh_store_is_open(store, 9 | OH_OSM_WAY, monday) == 0);
+	CU_ASSERT(oh_store_load_osm(store, path, "opening_hours:*", 0, NULL, &duplicates) == 2 && duplicates == 1);
+	CU_ASSERT(oh_store_is_open(store, 9 | OH_OSM_WAY, monday) == 1 && oh_store_size(store) == 4);
+	CU_ASSERT(oh_store_load_osm(store, path, "opening_hours*", 0, NULL, &duplicates) == 4 && duplicates == 2);
+	CU_ASSERT(oh_store_is_open(store, 9 | OH_OSM_WAY, saturday) == 1 && oh_store_size(store) == 4);
+	unlink(path);
+	CU_ASSERT(oh_store_load_osm(store, path, NULL, 1, NULL, NULL) == -1);
+	oh_store_free(store);
+}
+
+void schedule_diff(void) {
+	opening_hours before = build_opening_hours("Mo-Fr 09:00-18:00; Su 10:00-16:00"),
+		      after = build_opening_hours("Mo-Fr 09:00-18:00; Sa 10:00-14:00");
+	/* Mon 18 July 2016, 00:00 UTC */
+	time_t monday = 17000 * 86400L;
+	oh_diff diff;
+
+	CU_ASSERT(oh_diff_schedules(before, after, monday, monday + 7 * 86400, &diff) == 1);
+	CU_ASSERT(diff.nb_added == 1 && diff.nb_removed == 1);
+	CU_ASSERT(diff.added[0].start == monday + 5 * 86400 + 10 * 3600 && diff.added[0].end == monday + 5 * 86400 + 14 * 3600);
+	CU_ASSERT(diff.removed[0].start == monday + 6 * 86400 + 10 * 3600 && diff.removed[0].end == monday + 6 * 86400 + 16 * 3600);
+	oh_diff_free(&diff);
+	CU_ASSERT(oh_diff_schedules(before, after, monday + 5 * 86400 + 12 * 3600, monday + 6 * 86400, &diff) == 1);
+	CU_ASSERT(diff.nb_added == 1 && !diff.nb_removed && diff.added[0].start == monday + 5 * 86400 + 12 * 3600);
+	oh_diff_free(&diff);
+	CU_ASSERT(oh_diff_schedules(before, before, monday, monday + 365 * 86400, &diff) == 1);
+	CU_ASSERT(!diff.nb_added && !diff.nb_removed && !diff.added && !diff.removed);
+	CU_ASSERT(oh_diff_schedules(before, NULL, monday, monday + 86400, &diff) == 0);
+	free_oh(before);
+	free_oh(after);
+}
+
+typedef struct allocation_counts allocation_counts;
+
+struct allocation_counts {
+	size_t allocations;
+	size_t frees;
+};
+
+static void *counting_malloc(void *counts, size_t size) {
+	++((allocation_counts *) counts)->allocations;
+	return (malloc(size));
+}
+
+static void *counting_calloc(void *counts, size_t nmemb, size_t size) {
+	++((allocation_counts *) counts)->allocations;
+	return (calloc(nmemb, size));
+}
+
+static void *counting_realloc(void *counts, void *ptr, size_t size) {
+	if (!ptr)
+		++((allocation_counts *) counts)->allocations;
+	return (realloc(ptr, size));
+}
+
+static void counting_free(void *counts, void *ptr) {
+	++((allocation_counts *) counts)->frees;
+	free(ptr);
+}
+
+void selector_pool(void) {
+	opening_hours a = build_opening_hours("Mo-Fr 09:00-18:00; Sa 09:00-18:00"),
+		      b = build_opening_hours("2020 Mo-Fr 09:00-18:00"),
+		      every_day = build_opening_hours("Mo-Su 10:00-12:00"),
+		      unconstrained = build_opening_hours("10:00-12:00"),
+		      both = oh_union(a, b);
+	bitset hours = b->rule.selector.small_range.hours.time_range;
+	oh_memory_stats stats;
+
+	CU_ASSERT(a->rule.selector.small_range.weekday.range == b->rule.selector.small_range.weekday.range);
+	CU_ASSERT(a->rule.selector.small_range.hours.time_range == hours);
+	CU_ASSERT(a->next_item->rule.selector.small_range.hours.time_range == hours);
+	CU_ASSERT(both->rule.selector.small_range.hours.time_range == hours);
+	CU_ASSERT(every_day->rule.selector.small_range.weekday.range == unconstrained->rule.selector.small_range.weekday.range);
+	CU_ASSERT(oh_memory_usage(b, &stats) && !stats.weekdays_bytes && !stats.hours_bytes);
+	CU_ASSERT(stats.shared_bytes >= 2 * BITSET_NBYTES(hours));
+	free_oh(a);
+	free_oh(both);
+	CU_ASSERT(oh_memory_usage(b, &stats) && stats.weekdays_bytes && stats.hours_bytes == bitset_allocated_bytes(hours, 1));
+	CU_ASSERT(is_open_expended(b, 0, 12, 3, 0, 120, 5) && !is_open_expended(b, 0, 12, 4, 0, 120, 6));
+	free_oh(unconstrained);
+	free_oh(every_day);
+	free_oh(b);
+}
+
+void adaptive_ordering(void) {
+	char *s = "Dec 25 off; Jan-Nov Mo-Fr 09:00-17:00; Dec 01-Dec 23 Mo-Su 09:00-20:00; Dec 24-Dec 31 Mo-Sa 10:00-14:00";
+	opening_hours plain = build_opening_hours(s), adaptive = build_opening_hours(s);
+	oh_counters before, after;
+	oh_memory_stats plain_stats, stats;
+	int instrumented, mismatches = 0, round, i, day;
+	unsigned long scanned[2];
+
+	CU_ASSERT(oh_memory_usage(plain, &plain_stats) && !plain_stats.adaptive_bytes);
+	CU_ASSERT(oh_adaptive_ordering(NULL, 1) == 0);
+	CU_ASSERT(oh_adaptive_ordering(adaptive, 1) == 1);
+	/* The order itself, and its rules, overlaps, hits and positions. */
+	CU_ASSERT(oh_memory_usage(adaptive, &stats) && stats.nb_allocations == plain_stats.nb_allocations + 5);
+	CU_ASSERT(stats.adaptive_bytes > 4 * (sizeof(opening_hours) + sizeof(unsigned long) + sizeof(size_t)));
+	CU_ASSERT(stats.total_bytes == plain_stats.total_bytes + stats.adaptive_bytes);
+	for (round = 0; round < 2; round++) {
+		instrumented = oh_counters_snapshot(&before);
+		for (i = 0; i < 8192; i++) {
+			day = 24 + i % 8;
+			mismatches += is_open_expended(adaptive, i % 60, 8 + i % 8, day, 11, 126, (day + 4) % 7)
+				!= is_open_expended(plain, i % 60, 8 + i % 8, day, 11, 126, (day + 4) % 7);
+		}
+		oh_counters_snapshot(&after);
+		scanned[round] = after.rules_scanned - before.rules_scanned;
+	}
+	CU_ASSERT(mismatches == 0);
+	if (instrumented)
+		CU_ASSERT(scanned[1] < scanned[0]);
+	/* Replaced orders are kept until the rules are freed. */
+	CU_ASSERT(oh_memory_usage(adaptive, &stats) && stats.nb_allocations > plain_stats.nb_allocations + 5);
+	CU_ASSERT(stats.total_bytes == plain_stats.total_bytes + stats.adaptive_bytes);
+	/* Dec 25 off overlaps the last rule, which matches most: it must still come first. */
+	CU_ASSERT(!is_open_expended(adaptive, 0, 11, 25, 11, 126, 5) && is_open_expended(adaptive, 0, 11, 26, 11, 126, 6));
+	CU_ASSERT(oh_adaptive_ordering(adaptive, 0) == 1);
+	CU_ASSERT(!is_open_expended(adaptive, 0, 11, 25, 11, 126, 5) && is_open_expended(adaptive, 0, 11, 26, 11, 126, 6));
+	free_oh(plain);
+	free_oh(adaptive);
+}
+
+void variable_times(void) {
+	opening_hours oh = build_opening_hours("sunrise-sunset"),
+		      late = build_opening_hours("Mo-Fr (sunset-01:00)-02:00");
+	time_t june_21 = 1782000000 - 1782000000 % 86400;
+	oh_memory_stats before, stats;
+	long open = 0;
+	oh_error err;
+	int minute;
+
+	CU_ASSERT(oh_validate("Sa dawn-dusk, 10:00-sunset", 26, &err) == 1);
+	CU_ASSERT(oh_validate("(sunrise+01:00)-(sunset-00:30)", 30, &err) == 1);
+	CU_ASSERT(oh_validate("(sunrise 01:00)-sunset", 22, &err) == 0 && err.offset == 9);
+	CU_ASSERT(oh_validate("sunset-sunset", 13, &err) == 0);
+	/* Without a location, the sun rises at 06:00 and sets at 18:00. */
+	CU_ASSERT(!is_open_expended(oh, 59, 5, 21, 5, 126, 0) && is_open_expended(oh, 0, 6, 21, 5, 126, 0));
+	CU_ASSERT(is_open_expended(oh, 59, 17, 21, 5, 126, 0) && !is_open_expended(oh, 0, 18, 21, 5, 126, 0));
+	CU_ASSERT(oh_set_location(NULL, 48.8566, 2.3522, 120) == 0);
+	CU_ASSERT(oh_set_location(oh, 91, 2.3522, 120) == 0);
+	/* Paris, in summer time: 05:47 to 21:58 on Jun 21st 2026. */
+	CU_ASSERT(oh_memory_usage(oh, &before));
+	CU_ASSERT(oh_set_location(oh, 48.8566, 2.3522, 120) == 1);
+	/* The solar table of the location is shared by the schedules of its cell. */
+	CU_ASSERT(oh_memory_usage(oh, &stats) && stats.total_bytes == before.total_bytes);
+	CU_ASSERT(stats.shared_bytes >= before.shared_bytes + 12 * 32 * 4 * sizeof(short));
+	CU_ASSERT(!is_open_expended(oh, 46, 5, 21, 5, 126, 0) && is_open_expended(oh, 47, 5, 21, 5, 126, 0));
+	CU_ASSERT(is_open_expended(oh, 57, 21, 21, 5, 126, 0) && !is_open_expended(oh, 58, 21, 21, 5, 126, 0));
+	/* In UTC, oh_open_minutes() agrees with is_open(). */
+	CU_ASSERT(oh_set_location(oh, 48.8566, 2.3522, 0) == 1);
+	for (minute = 0; minute < 24 * 60; minute++)
+		open += is_open_expended(oh, minute % 60, minute / 60, 21, 5, 126, 0);
+	CU_ASSERT(open == 16 * 60 + 11 && oh_open_minutes(oh, june_21, june_21 + 24 * 60 * 60) == open);
+	/* Svalbard: the sun doesn't set in June, nor rise in December. */
+	CU_ASSERT(oh_set_location(oh, 78.22, 15.65, 60) == 1);
+	CU_ASSERT(is_open_expended(oh, 0, 0, 21, 5, 126, 0) && is_open_expended(oh, 0, 12, 21, 5, 126, 0));
+	CU_ASSERT(!is_open_expended(oh, 0, 12, 21, 11, 126, 1));
+	/* Spans ending before they start go on the next day, for the days they select. */
+	CU_ASSERT(is_open_expended(late, 0, 17, 21, 11, 126, 1) && is_open_expended(late, 59, 1, 22, 11, 126, 2));
+	CU_ASSERT(!is_open_expended(late, 0, 2, 22, 11, 126, 2) && !is_open_expended(late, 0, 1, 21, 11, 126, 1));
+	/* Variable times don't use an adaptive order: none is bound, only the structure holding it is allocated. */
+	CU_ASSERT(oh_memory_usage(late, &before) && oh_adaptive_ordering(late, 1) == 1);
+	CU_ASSERT(oh_memory_usage(late, &stats) && stats.nb_allocations == before.nb_allocations + 1);
+	CU_ASSERT(is_open_expended(late, 0, 17, 21, 11, 126, 1) && !is_open_expended(late, 0, 2, 22, 11, 126, 2));
+	free_oh(oh);
+	free_oh(late);
+}
+
+void custom_allocator(void) {
+	allocation_counts counts = {0, 0};
+	oh_allocator counting = {counting_malloc, counting_calloc, counting_realloc, counting_free, &counts};
+	opening_hours a, b, both;
+
+	oh_set_thread_allocator(&counting);
+	CU_ASSERT(oh_current_allocator() == &counting);
+	a = build_opening_hours("Mo-Fr 09:00-18:00");
+	b = build_opening_hours("Tu-Sa 12:00-20:00");
+	both = oh_intersection(a, b);
+	print_oh(both);
+	CU_ASSERT(counts.allocations > 0 && counts.frees < counts.allocations);
+	free_oh(a);
+	free_oh(b);
+	free_oh(both);
+	CU_ASSERT(counts.frees == counts.allocations);
+	oh_set_thread_allocator(NULL);
+	free_oh(build_opening_hours("Mo 10:00-12:00"));
+	CU_ASSERT(counts.frees == counts.allocations && oh_current_allocator() != &counting);
+	oh_set_allocator(&counting);
+	counts.allocations = counts.frees = 0;
+	free_oh(build_opening_hours("Mo 10:00-12:00"));
+	CU_ASSERT(counts.allocations > 0 && counts.frees == counts.allocations);
+	oh_set_allocator(NULL);
 }
 
 int main() {
@@ -116,6 +750,28 @@ int main() {
 	ADD_TEST(wide_and_small_ranges);
 	ADD_TEST(wide_and_small_ranges);
 	ADD_TEST(opening_tests);
+	ADD_TEST(memory_usage);
+	ADD_TEST(hot_path_counters);
+	ADD_TEST(incremental_edit);
+	ADD_TEST(set_algebra);
+	ADD_TEST(bitset_kernels);
+	ADD_TEST(bitset_scanning);
+	ADD_TEST(open_minutes);
+	ADD_TEST(fingerprints);
+	ADD_TEST(window_queries);
+	ADD_TEST(open_slots);
+	ADD_TEST(open_histogram);
+	ADD_TEST(object_store);
+	ADD_TEST(validation);
+	ADD_TEST(specialized_evaluators);
+	ADD_TEST(out_of_range_years);
+	ADD_TEST(calendar_conversion);
+	ADD_TEST(osm_loading);
+	ADD_TEST(schedule_diff);
+	ADD_TEST(custom_allocator);
+	ADD_TEST(selector_pool);
+	ADD_TEST(adaptive_ordering);
+	ADD_TEST(variable_times);
 
 	CU_basic_set_mode(CU_BRM_VERBOSE);
 	CU_basic_run_tests();
@@ -19,13 +19,15 @@ int parse_year_range(bitset *years, char **s) {
 	while (**s == ' ') ++*s;
 
 	if (strstr(*s, ",") == *s) {
-		printf("Invalid syntax: empty element at list of ranges. Expected value before coma.\n");
+		parse_error("Invalid syntax: empty element at list of ranges. Expected value before coma.\n");
 		return (ERROR);
 	}
 
-	*years = Bitset(1024);
+	*years = NULL;
 	do {
 		if (match(*s, "^[0-9]{4}([^0-9]|$)")) {
+			if (!*years)
+				*years = PARSE_BITSET(1024);
 			if (match(*s + 4, "^ *- *[0-9]{4}([^0-9]|$)")) {
 				range[0] = atoi(*s);
 				while (isdigit(**s)) ++*s;
@@ -34,21 +36,24 @@ int parse_year_range(bitset *years, char **s) {
 				while (**s == ' ') ++*s;
 				range[1] = atoi(*s);
 				while (isdigit(**s)) ++*s;
-				set_subset(*years, range[0] - 1900, range[1] - 1900, true);
+				PARSE_SET_SUBSET(*years, range[0] - 1900, range[1] - 1900, true);
 			} else {
 				range[1] = range[0] = atoi(*s);
 				if (range[1] < 1900) {
-					printf("Invalid range: year must be greater than or equal to 1900\n");
+					parse_error("Invalid range: year must be greater than or equal to 1900\n");
 					return (ERROR);
 				} else if (range[1] > 2923) {
-					printf("Invalid range: are you sure somebody still could use your opening hours in %d?\n", range[1]);
+					parse_error("Invalid range: are you sure somebody still could use your opening hours in %d?\n", range[1]);
 					return (ERROR);
 				}
 				*s += 4;
-				SET_BIT(*years, range[0] - 1900, true);
+				PARSE_SET_BIT(*years, range[0] - 1900, true);
 			}
+		} else if (!*years) {
+			*years = shared_years;
+			return (EMPTY);
 		} else {
-			set_subset(*years, range[0] - 1900, range[1] - 1900, true);
+			PARSE_SET_SUBSET(*years, range[0] - 1900, range[1] - 1900, true);
 			return (EMPTY);
 		}
 	} while (strstr(*s, ",") == *s && *(++*s));
@@ -61,11 +66,11 @@ int parse_monthday_range(monthday_range *monthday, char **s) {
 
 	while (**s == ' ') ++*s;
 
-	monthday->days = Bitset(12 * 32);
 	if (get_month_id(*s) == 12) {
-		set_subset(monthday->days, 0, 12 * 32, true);
+		monthday->days = shared_monthdays;
 		return (EMPTY);
 	}
+	monthday->days = PARSE_BITSET(12 * 32);
 	do {
 		while (**s == ' ') ++*s;
 		if (strstr(*s, "easter ") == *s) {
@@ -73,21 +78,21 @@ int parse_monthday_range(monthday_range *monthday, char **s) {
 			while (**s == ' ') ++*s;
 			monthday->easter = true;
 			if (**s == '-') {
-				printf("Unsupported syntax: ranges including easter aren't allowed here, aborting.\n");
+				parse_error("Unsupported syntax: ranges including easter aren't allowed here, aborting.\n");
 				return (ERROR);
 			}
 			continue;
 		}
 		month_id = get_month_id(*s);
 		if (month_id == 12) {
-			printf("Invalid syntax: expected month in the monthday_range.\n");
+			parse_error("Invalid syntax: expected month in the monthday_range.\n");
 			return (ERROR);
 		}
 		*s += 3;
 		while (**s == ' ') ++*s;
 		if ((dayto = daynum = atoi(*s))) {
 			if (daynum > NB_DAYS[month_id]) {
-				printf("Invalid range: day %d doesn't exist for %s.\n", daynum, MONTHS_FULLSTR[month_id]);
+				parse_error("Invalid range: day %d doesn't exist for %s.\n", daynum, MONTHS_FULLSTR[month_id]);
 				return (ERROR);
 			}
 			while (isdigit(**s)) ++*s;
@@ -97,18 +102,18 @@ int parse_monthday_range(monthday_range *monthday, char **s) {
 			++*s;
 			while (**s == ' ') ++*s;
 			if (strstr(*s, "easter") == *s) {
-				printf("Unsupported syntax: ranges including easter aren't allowed here, aborting.\n");
+				parse_error("Unsupported syntax: ranges including easter aren't allowed here, aborting.\n");
 				return (ERROR);
 			}
 			if ((month_to = get_month_id(*s)) == 12) {
-				printf("Invalid syntax: month range enclosed without new month. Aborting.\n");
+				parse_error("Invalid syntax: month range enclosed without new month. Aborting.\n");
 				return (ERROR);
 			}
 			*s += 3;
 			while (**s == ' ') ++*s;
 			if ((dayto = atoi(*s))) {
 				if (dayto > NB_DAYS[month_to]) {
-					printf("Invalid range: day %d doesn't exist for %s.\n", dayto, MONTHS_FULLSTR[month_id]);
+					parse_error("Invalid range: day %d doesn't exist for %s.\n", dayto, MONTHS_FULLSTR[month_id]);
 					return (ERROR);
 				}
 				while (isdigit(**s)) ++*s;
@@ -117,17 +122,17 @@ int parse_monthday_range(monthday_range *monthday, char **s) {
 			}
 			daynum = !daynum ? 1 : daynum;
 			if (month_to > month_id || (month_to == month_id && dayto >= daynum)) {
-				set_subset(monthday->days, month_id * 32 + daynum - 1, month_to * 32 + dayto - 2, true);
+				PARSE_SET_SUBSET(monthday->days, month_id * 32 + daynum - 1, month_to * 32 + dayto - 2, true);
 			} else {
-				set_subset(monthday->days, month_id * 32 + daynum - 1, 12 * 32, true);
-				set_subset(monthday->days, 0, month_to * 32 + dayto - 1, true);
+				PARSE_SET_SUBSET(monthday->days, month_id * 32 + daynum - 1, 12 * 32, true);
+				PARSE_SET_SUBSET(monthday->days, 0, month_to * 32 + dayto - 1, true);
 			}
 			while (isdigit(**s)) ++*s;
 		} else {
 			if (!daynum)
-				set_subset(monthday->days, month_id * 32, month_id * 32 + 31, true);
+				PARSE_SET_SUBSET(monthday->days, month_id * 32, month_id * 32 + 31, true);
 			else
-				SET_BIT(monthday->days, month_id * 32 + daynum - 1, true);
+				PARSE_SET_BIT(monthday->days, month_id * 32 + daynum - 1, true);
 		}
 	} while (strstr(*s, ",") == *s && *(++*s));
 	return (SUCCESS);
@@ -138,19 +143,19 @@ int parse_week_selector(bitset *weeks, char **s) {
 
 	while (**s == ' ') ++*s;
 
-	*weeks = Bitset(54);
 	if (strstr(*s, "week ") != *s) {
-		set_subset(*weeks, 0, 52, true);
+		*weeks = shared_weeks;
 		return (EMPTY);
 	}
+	*weeks = PARSE_BITSET(54);
 	*s += sizeof("week");
 	do {
 		while (**s == ' ') ++*s;
 		if ((weeknum = atoi(*s)) < 1 || weeknum > 54) {
-			printf("Invalid syntax: week %d doesn't exist.\n", weeknum);
+			parse_error("Invalid syntax: week %d doesn't exist.\n", weeknum);
 			return (ERROR);
 		}
-		SET_BIT(*weeks, weeknum - 1, true);
+		PARSE_SET_BIT(*weeks, weeknum - 1, true);
 		while (isdigit(**s)) ++*s;
 	} while (strstr(*s, ",") == *s && *(++*s));
 	return (SUCCESS);
@@ -164,18 +169,19 @@ int parse_wide_range_selector(wide_range_selector *selector, char **s) {
 	if (**s == '"') {
 		selector->type = WIDE_RANGE_COMMENT;
 		if (!strstr(*s + 1, "\"")) {
-			printf("Invalid syntax: unclosed quote for comment as selector.\n");
+			parse_error("Invalid syntax: unclosed quote for comment as selector.\n");
 			return (ERROR);
 		} else if (!match(*s, "[^\"]*\" *:")) {
 			*s = strstr(*s + 1, "\"") + 1;
-			printf("Invalid syntax: missing colon right after enclosing quote for the selector.\n");
+			parse_error("Invalid syntax: missing colon right after enclosing quote for the selector.\n");
 			return (ERROR);
 		} else if ((*s)[1] == '"') {
 			++*s;
-			printf("Invalid syntax: empty comment.\n");
+			parse_error("Invalid syntax: empty comment.\n");
 			return (ERROR);
 		}
-		strncpy(selector->comment, *s + 1, strstr(*s + 1, "\"") - *s - 1);
+		if (!VALIDATING)
+			strncpy(selector->comment, *s + 1, strstr(*s + 1, "\"") - *s - 1);
 		*s = strstr(*s + 1, ":") + 1;
 		return (SUCCESS);
 	}
@@ -190,7 +196,7 @@ int parse_wide_range_selector(wide_range_selector *selector, char **s) {
 			&& week_res == EMPTY) {
 		while (**s == ' ') ++*s;
 		if (strstr(*s, ":") == *s) {
-			printf("Invalid syntax: empty wide range selector.\n");
+			parse_error("Invalid syntax: empty wide range selector.\n");
 			return (ERROR);
 		}
 		return (EMPTY);